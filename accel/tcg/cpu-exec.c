@@ -193,9 +193,9 @@ static bool tb_lookup_cmp(const void *p, const void *d)
     return false;
 }
 
-static TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
-                                          uint64_t cs_base, uint32_t flags,
-                                          uint32_t cflags)
+TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc,
+                                   uint64_t cs_base, uint32_t flags,
+                                   uint32_t cflags)
 {
     tb_page_addr_t phys_pc;
     struct tb_desc desc;
@@ -552,6 +552,7 @@ static void cpu_exec_longjmp_cleanup(CPUState *cpu)
         tb_unlock_pages(tcg_ctx->gen_tb);
         tcg_ctx->gen_tb = NULL;
     }
+    tb_inflight_end();
 #endif
     if (bql_locked()) {
         bql_unlock();
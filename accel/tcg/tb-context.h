@@ -21,19 +21,27 @@
 #define QEMU_TB_CONTEXT_H
 
 #include "qemu/thread.h"
+#include "qemu/queue.h"
 #include "qemu/qht.h"
 
 #define CODE_GEN_HTABLE_BITS     15
 #define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
 
 typedef struct TBContext TBContext;
+typedef struct TBInflight TBInflight;
 
 struct TBContext {
 
     struct qht htable;
 
+    /* translations in progress, see tb_inflight_begin() */
+    QemuMutex inflight_lock;
+    QemuCond inflight_cond;
+    QLIST_HEAD(, TBInflight) inflight;
+
     /* statistics */
     unsigned tb_flush_count;
+    unsigned tb_evict_count;
     unsigned tb_phys_invalidate_count;
 };
 
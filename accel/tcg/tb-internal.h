@@ -78,6 +78,13 @@ void tb_unlock_page1(tb_page_addr_t, tb_page_addr_t);
 void tb_unlock_pages(TranslationBlock *);
 #endif
 
+#ifdef CONFIG_USER_ONLY
+/* In user-mode mmap_lock already serializes translation. */
+static inline void tb_inflight_end(void) { }
+#else
+void tb_inflight_end(void);
+#endif
+
 #ifdef CONFIG_SOFTMMU
 void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
                                    unsigned size,
@@ -86,4 +93,14 @@ void tb_invalidate_phys_range_fast(ram_addr_t ram_addr,
 
 bool tb_invalidate_phys_page_unwind(tb_page_addr_t addr, uintptr_t pc);
 
+/*
+ * Make room in the code buffer by invalidating the translation blocks of
+ * the oldest full region, or everything if no region can be evicted.
+ * Like tb_flush(), this runs in an exclusive context.
+ */
+void tb_evict(CPUState *cpu);
+
+TranslationBlock *tb_htable_lookup(CPUState *cpu, vaddr pc, uint64_t cs_base,
+                                   uint32_t flags, uint32_t cflags);
+
 #endif
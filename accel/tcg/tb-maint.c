@@ -65,6 +65,9 @@ void tb_htable_init(void)
     unsigned int mode = QHT_MODE_AUTO_RESIZE;
 
     qht_init(&tb_ctx.htable, tb_cmp, CODE_GEN_HTABLE_SIZE, mode);
+    qemu_mutex_init(&tb_ctx.inflight_lock);
+    qemu_cond_init(&tb_ctx.inflight_cond);
+    QLIST_INIT(&tb_ctx.inflight);
 }
 
 typedef struct PageDesc PageDesc;
@@ -904,9 +907,11 @@ static void tb_jmp_cache_inval_tb(TranslationBlock *tb)
 /*
  * In user-mode, call with mmap_lock held.
  * In !user-mode, if @rm_from_page_list is set, call with the TB's pages'
- * locks held.
+ * locks held.  @inval_jmp_cache may only be clear if the caller flushes
+ * the jump caches of all CPUs itself.
  */
-static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
+static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list,
+                                  bool inval_jmp_cache)
 {
     uint32_t h;
     tb_page_addr_t phys_pc;
@@ -933,7 +938,9 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
     }
 
     /* remove the TB from the hash list */
-    tb_jmp_cache_inval_tb(tb);
+    if (inval_jmp_cache) {
+        tb_jmp_cache_inval_tb(tb);
+    }
 
     /* suppress this TB from the two jump lists */
     tb_remove_from_jmp_list(tb, 0);
@@ -949,7 +956,7 @@ static void do_tb_phys_invalidate(TranslationBlock *tb, bool rm_from_page_list)
 static void tb_phys_invalidate__locked(TranslationBlock *tb)
 {
     qemu_thread_jit_write();
-    do_tb_phys_invalidate(tb, true);
+    do_tb_phys_invalidate(tb, true, true);
     qemu_thread_jit_execute();
 }
 
@@ -961,10 +968,98 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
 {
     if (page_addr == -1 && tb_page_addr0(tb) != -1) {
         tb_lock_pages(tb);
-        do_tb_phys_invalidate(tb, true);
+        do_tb_phys_invalidate(tb, true, true);
         tb_unlock_pages(tb);
     } else {
-        do_tb_phys_invalidate(tb, false);
+        do_tb_phys_invalidate(tb, false, true);
+    }
+}
+
+/* Bumped by both flushes and evictions, so that only one of them runs. */
+static unsigned tb_cache_generation(void)
+{
+    return qatomic_read(&tb_ctx.tb_flush_count) +
+           qatomic_read(&tb_ctx.tb_evict_count);
+}
+
+static gboolean tb_evict_collect(gpointer key, gpointer value, gpointer data)
+{
+    g_ptr_array_add(data, value);
+    return false;
+}
+
+/* Throw away the oldest full region, see tb_evict() */
+static void do_tb_evict(CPUState *cpu, run_on_cpu_data generation)
+{
+    g_autoptr(GPtrArray) tbs = NULL;
+    CPUState *cs;
+    size_t idx;
+
+    mmap_lock();
+    /* Another CPU flushed or evicted since this was queued: just retry. */
+    if (tb_cache_generation() != generation.host_int) {
+        goto done;
+    }
+
+#ifdef CONFIG_PLUGIN
+    /*
+     * Plugin callback data is only released on a full flush and may be
+     * shared by translations that are not evicted.
+     */
+    CPU_FOREACH(cs) {
+        if (test_bit(QEMU_PLUGIN_EV_VCPU_TB_TRANS,
+                     cs->plugin_state->event_mask)) {
+            goto flush;
+        }
+    }
+#endif
+    if (!tcg_region_oldest_full(&idx)) {
+        goto flush;
+    }
+
+    /* Cheaper than removing each TB, which may be at any virtual address. */
+    CPU_FOREACH(cs) {
+        tcg_flush_jmp_cache(cs);
+    }
+
+    tbs = g_ptr_array_new();
+    tcg_region_tb_foreach(idx, tb_evict_collect, tbs);
+
+    qemu_thread_jit_write();
+    for (guint i = 0; i < tbs->len; i++) {
+        TranslationBlock *tb = g_ptr_array_index(tbs, i);
+
+        if (tb_page_addr0(tb) != -1) {
+            tb_lock_pages(tb);
+            do_tb_phys_invalidate(tb, true, false);
+            tb_unlock_pages(tb);
+        } else {
+            do_tb_phys_invalidate(tb, false, false);
+        }
+    }
+    qemu_thread_jit_execute();
+
+    tcg_region_release(idx);
+    qatomic_inc(&tb_ctx.tb_evict_count);
+
+done:
+    mmap_unlock();
+    return;
+
+flush:
+    do_tb_flush(cpu, RUN_ON_CPU_HOST_INT(tb_ctx.tb_flush_count));
+    mmap_unlock();
+}
+
+void tb_evict(CPUState *cpu)
+{
+    unsigned generation = tb_cache_generation();
+
+    if (cpu_in_serial_context(cpu)) {
+        do_tb_evict(cpu, RUN_ON_CPU_HOST_INT(generation));
+    } else {
+        async_safe_run_on_cpu(cpu, do_tb_evict,
+                              RUN_ON_CPU_HOST_INT(generation));
     }
 }
 
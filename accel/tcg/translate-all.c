@@ -286,6 +286,114 @@ static int setjmp_gen_code(CPUArchState *env, TranslationBlock *tb,
     return tcg_gen_code(tcg_ctx, tb, pc);
 }
 
+#ifdef CONFIG_USER_ONLY
+static inline TranslationBlock *
+tb_inflight_begin(CPUState *cpu, tb_page_addr_t phys_pc, vaddr pc,
+                  uint64_t cs_base, uint32_t flags, uint32_t cflags)
+{
+    return NULL;
+}
+#else
+/*
+ * With MTTCG, vCPUs that miss on the same code at once, as they do while
+ * booting, would each translate it and all but one copy would then be
+ * discarded by tb_link_page().  Instead, the first vCPU to miss records
+ * the translation here, and the others wait for it to be published.
+ */
+struct TBInflight {
+    tb_page_addr_t phys_pc;
+    vaddr pc;
+    uint64_t cs_base;
+    uint32_t flags;
+    uint32_t cflags;
+    bool active;
+    QLIST_ENTRY(TBInflight) entry;
+};
+
+/*
+ * Not on the stack of tb_gen_code(): if translation longjmps out,
+ * cpu_exec_longjmp_cleanup() still has to unlink the entry.
+ */
+static __thread TBInflight tb_inflight;
+
+/* Called with tb_ctx.inflight_lock held. */
+static bool tb_inflight_find(tb_page_addr_t phys_pc, vaddr pc,
+                             uint64_t cs_base, uint32_t flags,
+                             uint32_t cflags)
+{
+    TBInflight *t;
+
+    QLIST_FOREACH(t, &tb_ctx.inflight, entry) {
+        if (t->phys_pc == phys_pc &&
+            (cflags & CF_PCREL || t->pc == pc) &&
+            t->cs_base == cs_base &&
+            t->flags == flags &&
+            t->cflags == cflags) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Returns the TB if another vCPU translated it while we waited, or NULL
+ * once this vCPU is registered as the one translating it.
+ */
+static TranslationBlock *
+tb_inflight_begin(CPUState *cpu, tb_page_addr_t phys_pc, vaddr pc,
+                  uint64_t cs_base, uint32_t flags, uint32_t cflags)
+{
+    TranslationBlock *tb;
+
+    /* A single vCPU thread, or a one-shot TB: nothing to share. */
+    if (!(cflags & CF_PARALLEL) || phys_pc == -1) {
+        return NULL;
+    }
+
+    for (;;) {
+        qemu_mutex_lock(&tb_ctx.inflight_lock);
+        if (!tb_inflight_find(phys_pc, pc, cs_base, flags, cflags)) {
+            break;
+        }
+        do {
+            qemu_cond_wait(&tb_ctx.inflight_cond, &tb_ctx.inflight_lock);
+        } while (tb_inflight_find(phys_pc, pc, cs_base, flags, cflags));
+        qemu_mutex_unlock(&tb_ctx.inflight_lock);
+
+        /*
+         * The other translation may have been abandoned, e.g. on a fault,
+         * or may differ in its second page; then translate it ourselves.
+         */
+        tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
+        if (tb) {
+            return tb;
+        }
+    }
+
+    tb_inflight.phys_pc = phys_pc;
+    tb_inflight.pc = pc;
+    tb_inflight.cs_base = cs_base;
+    tb_inflight.flags = flags;
+    tb_inflight.cflags = cflags;
+    tb_inflight.active = true;
+    QLIST_INSERT_HEAD(&tb_ctx.inflight, &tb_inflight, entry);
+    qemu_mutex_unlock(&tb_ctx.inflight_lock);
+    return NULL;
+}
+
+void tb_inflight_end(void)
+{
+    if (!tb_inflight.active) {
+        return;
+    }
+    qemu_mutex_lock(&tb_ctx.inflight_lock);
+    QLIST_REMOVE(&tb_inflight, entry);
+    tb_inflight.active = false;
+    qemu_cond_broadcast(&tb_ctx.inflight_cond);
+    qemu_mutex_unlock(&tb_ctx.inflight_lock);
+}
+#endif /* CONFIG_USER_ONLY */
+
 /* Called with mmap_lock held for user mode emulation.  */
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               vaddr pc, uint64_t cs_base,
@@ -309,6 +417,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
         cflags = (cflags & ~CF_COUNT_MASK) | 1;
     }
 
+    tb = tb_inflight_begin(cpu, phys_pc, pc, cs_base, flags, cflags);
+    if (tb) {
+        return tb;
+    }
+
     max_insns = cflags & CF_COUNT_MASK;
     if (max_insns == 0) {
         max_insns = TCG_MAX_INSNS;
@@ -319,8 +432,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     assert_no_pages_locked();
     tb = tcg_tb_alloc(tcg_ctx);
     if (unlikely(!tb)) {
-        /* flush must be done */
-        tb_flush(cpu);
+        /* make room in the code buffer */
+        tb_evict(cpu);
         mmap_unlock();
         /* Make the execution loop process the flush as soon as possible.  */
         cpu->exception_index = EXCP_INTERRUPT;
@@ -553,6 +666,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      */
     if (tb_page_addr0(tb) == -1) {
         assert_no_pages_locked();
+        tb_inflight_end();
         return tb;
     }
 
@@ -562,6 +676,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
      */
     existing_tb = tb_link_page(tb);
     assert_no_pages_locked();
+    tb_inflight_end();
 
     /* if the TB already exists, discard what we just translated */
     if (unlikely(existing_tb != tb)) {
@@ -20,6 +20,7 @@
 #include "internal-target.h"
 #include "disas/disas.h"
 #include "tb-internal.h"
+#include "tb-hash.h"
 
 static void set_can_do_io(DisasContextBase *db, bool val)
 {
@@ -120,6 +121,84 @@ bool translator_use_goto_tb(DisasContextBase *db, vaddr dest)
     return translator_is_same_page(db, dest);
 }
 
+void translator_goto_ptr(DisasContextBase *db, TCGv_i64 dest)
+{
+    const TranslationBlock *tb = db->tb;
+    uint32_t cflags = tb_cflags(tb);
+    TCGLabel *miss;
+    TCGv_ptr jc, next;
+    TCGv_i64 h, t;
+    TCGv_i32 t32;
+
+    /*
+     * The inline probe skips the debug and logging checks that
+     * helper_lookup_tb_ptr makes, so leave any TB that needs them,
+     * or that was not generated with the default cflags, to the helper.
+     */
+    if ((cflags & (CF_COUNT_MASK | CF_NO_GOTO_TB | CF_NO_GOTO_PTR |
+                   CF_SINGLE_STEP | CF_MEMI_ONLY | CF_NOIRQ | CF_BP_PAGE)) ||
+        qemu_loglevel_mask(CPU_LOG_TB_CPU | CPU_LOG_EXEC)) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+
+    miss = gen_new_label();
+    jc = tcg_temp_new_ptr();
+    next = tcg_temp_new_ptr();
+    h = tcg_temp_new_i64();
+    t = tcg_temp_new_i64();
+    t32 = tcg_temp_new_i32();
+
+    /* Breakpoints may have been inserted since this TB was translated. */
+    tcg_gen_ld_ptr(jc, tcg_env,
+                   offsetof(ArchCPU, parent_obj.breakpoints.tqh_first) -
+                   offsetof(ArchCPU, env));
+    tcg_gen_brcondi_ptr(TCG_COND_NE, jc, 0, miss);
+
+    /* Compute tb_jmp_cache_hash_func(dest). */
+#ifdef CONFIG_SOFTMMU
+    tcg_gen_shri_i64(t, dest, TARGET_PAGE_BITS - TB_JMP_PAGE_BITS);
+    tcg_gen_xor_i64(t, t, dest);
+    tcg_gen_shri_i64(h, t, TARGET_PAGE_BITS - TB_JMP_PAGE_BITS);
+    tcg_gen_andi_i64(h, h, TB_JMP_PAGE_MASK);
+    tcg_gen_andi_i64(t, t, TB_JMP_ADDR_MASK);
+    tcg_gen_or_i64(h, h, t);
+#else
+    tcg_gen_shri_i64(h, dest, TB_JMP_CACHE_BITS);
+    tcg_gen_xor_i64(h, h, dest);
+    tcg_gen_andi_i64(h, h, TB_JMP_CACHE_SIZE - 1);
+#endif
+    tcg_gen_muli_i64(h, h, sizeof_field(CPUJumpCache, array[0]));
+
+    tcg_gen_ld_ptr(jc, tcg_env,
+                   offsetof(ArchCPU, parent_obj.tb_jmp_cache) -
+                   offsetof(ArchCPU, env));
+    tcg_gen_trunc_i64_ptr(next, h);
+    tcg_gen_add_ptr(jc, jc, next);
+
+    /* As in tb_lookup(), read the TB before the pc it was cached for. */
+    tcg_gen_ld_ptr(next, jc, offsetof(CPUJumpCache, array[0].tb));
+    tcg_gen_brcondi_ptr(TCG_COND_EQ, next, 0, miss);
+    tcg_gen_ld_i64(t, jc, offsetof(CPUJumpCache, array[0].pc));
+    tcg_gen_brcond_i64(TCG_COND_NE, t, dest, miss);
+
+    /* An invalidated TB has CF_INVALID set and fails the cflags test. */
+    tcg_gen_ld_i32(t32, next, offsetof(TranslationBlock, flags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, tb->flags, miss);
+    tcg_gen_ld_i32(t32, next, offsetof(TranslationBlock, cflags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, cflags, miss);
+    tcg_gen_ld_i64(t, next, offsetof(TranslationBlock, cs_base));
+    tcg_gen_brcondi_i64(TCG_COND_NE, t, tb->cs_base, miss);
+
+    /* As in helper_lookup_tb_ptr(); the next TB clears it again. */
+    set_can_do_io(db, true);
+    tcg_gen_ld_ptr(next, next, offsetof(TranslationBlock, tc.ptr));
+    tcg_gen_goto_ptr(next);
+
+    gen_set_label(miss);
+    tcg_gen_lookup_and_goto_ptr();
+}
+
 void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
                      vaddr pc, void *host_pc, const TranslatorOps *ops,
                      DisasContextBase *db)
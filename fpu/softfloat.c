@@ -396,6 +396,90 @@ float64_gen2(float64 xa, float64 xb, float_status *s,
     return soft(ua.s, ub.s, s);
 }
 
+/*
+ * Array flavors of the above. can_use_fpu() is checked once for the whole
+ * array: a softfloat fallback can only add flags, so the answer does not
+ * change part way through. The host op is then applied to a group of
+ * elements at a time, which the compiler is free to vectorize, and the
+ * pre/post checks of each element decide whether to redo it in softfloat.
+ * Groups are staged through locals so that @d may alias @a or @b.
+ */
+#define HARDFLOAT_GROUP 16
+
+static inline void
+float32_gen2_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+               float_status *s, hard_f32_op2_fn hard, soft_f32_op2_fn soft,
+               f32_check_fn pre, f32_check_fn post)
+{
+    union_float32 ua[HARDFLOAT_GROUP], ub[HARDFLOAT_GROUP];
+    union_float32 ur[HARDFLOAT_GROUP];
+    size_t i, j, k;
+
+    if (unlikely(!can_use_fpu(s) || s->flush_inputs_to_zero)) {
+        for (i = 0; i < n; i++) {
+            d[i] = float32_gen2(a[i], b[i], s, hard, soft, pre, post);
+        }
+        return;
+    }
+
+    for (i = 0; i < n; i += k) {
+        k = MIN(n - i, HARDFLOAT_GROUP);
+        for (j = 0; j < k; j++) {
+            ua[j].s = a[i + j];
+            ub[j].s = b[i + j];
+            ur[j].h = hard(ua[j].h, ub[j].h);
+        }
+        for (j = 0; j < k; j++) {
+            if (unlikely(!pre(ua[j], ub[j]))) {
+                ur[j].s = soft(ua[j].s, ub[j].s, s);
+            } else if (unlikely(f32_is_inf(ur[j]))) {
+                float_raise(float_flag_overflow, s);
+            } else if (unlikely(fabsf(ur[j].h) <= FLT_MIN) &&
+                       post(ua[j], ub[j])) {
+                ur[j].s = soft(ua[j].s, ub[j].s, s);
+            }
+            d[i + j] = ur[j].s;
+        }
+    }
+}
+
+static inline void
+float64_gen2_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+               float_status *s, hard_f64_op2_fn hard, soft_f64_op2_fn soft,
+               f64_check_fn pre, f64_check_fn post)
+{
+    union_float64 ua[HARDFLOAT_GROUP], ub[HARDFLOAT_GROUP];
+    union_float64 ur[HARDFLOAT_GROUP];
+    size_t i, j, k;
+
+    if (unlikely(!can_use_fpu(s) || s->flush_inputs_to_zero)) {
+        for (i = 0; i < n; i++) {
+            d[i] = float64_gen2(a[i], b[i], s, hard, soft, pre, post);
+        }
+        return;
+    }
+
+    for (i = 0; i < n; i += k) {
+        k = MIN(n - i, HARDFLOAT_GROUP);
+        for (j = 0; j < k; j++) {
+            ua[j].s = a[i + j];
+            ub[j].s = b[i + j];
+            ur[j].h = hard(ua[j].h, ub[j].h);
+        }
+        for (j = 0; j < k; j++) {
+            if (unlikely(!pre(ua[j], ub[j]))) {
+                ur[j].s = soft(ua[j].s, ub[j].s, s);
+            } else if (unlikely(f64_is_inf(ur[j]))) {
+                float_raise(float_flag_overflow, s);
+            } else if (unlikely(fabs(ur[j].h) <= DBL_MIN) &&
+                       post(ua[j], ub[j])) {
+                ur[j].s = soft(ua[j].s, ub[j].s, s);
+            }
+            d[i + j] = ur[j].s;
+        }
+    }
+}
+
 /*
  * Classify a floating point number. Everything above float_class_qnan
  * is a NaN so cls >= float_class_qnan is any NaN.
@@ -2023,6 +2107,38 @@ float64_sub(float64 a, float64 b, float_status *s)
     return float64_addsub(a, b, s, hard_f64_sub, soft_f64_sub);
 }
 
+void QEMU_FLATTEN
+float32_add_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+              float_status *s)
+{
+    float32_gen2_n(d, a, b, n, s, hard_f32_add, soft_f32_add,
+                   f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float32_sub_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+              float_status *s)
+{
+    float32_gen2_n(d, a, b, n, s, hard_f32_sub, soft_f32_sub,
+                   f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_add_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+              float_status *s)
+{
+    float64_gen2_n(d, a, b, n, s, hard_f64_add, soft_f64_add,
+                   f64_is_zon2, f64_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_sub_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+              float_status *s)
+{
+    float64_gen2_n(d, a, b, n, s, hard_f64_sub, soft_f64_sub,
+                   f64_is_zon2, f64_addsubmul_post);
+}
+
 static float64 float64r32_addsub(float64 a, float64 b, float_status *status,
                                  bool subtract)
 {
@@ -2176,6 +2292,22 @@ float64_mul(float64 a, float64 b, float_status *s)
                         f64_is_zon2, f64_addsubmul_post);
 }
 
+void QEMU_FLATTEN
+float32_mul_n(float32 *d, const float32 *a, const float32 *b, size_t n,
+              float_status *s)
+{
+    float32_gen2_n(d, a, b, n, s, hard_f32_mul, soft_f32_mul,
+                   f32_is_zon2, f32_addsubmul_post);
+}
+
+void QEMU_FLATTEN
+float64_mul_n(float64 *d, const float64 *a, const float64 *b, size_t n,
+              float_status *s)
+{
+    float64_gen2_n(d, a, b, n, s, hard_f64_mul, soft_f64_mul,
+                   f64_is_zon2, f64_addsubmul_post);
+}
+
 float64 float64r32_mul(float64 a, float64 b, float_status *status)
 {
     FloatParts64 pa, pb, *pr;
@@ -226,6 +226,22 @@ SRST
     Show the active virtual memory mappings.
 ERST
 
+#if defined(TARGET_RISCV)
+    {
+        .name       = "hfi",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show the HFI sandbox state and statistics",
+        .cmd        = hmp_info_hfi,
+    },
+#endif
+
+SRST
+  ``info hfi``
+    Show the HFI sandbox state, regions and statistics of the current
+    CPU (RISC-V only).
+ERST
+
     {
         .name       = "mtree",
         .args_type  = "flatview:-f,dispatch_tree:-d,owner:-o,disabled:-D",
@@ -129,6 +129,18 @@ void tlb_flush_page_all_cpus_synced(CPUState *src, vaddr addr);
  */
 void tlb_flush(CPUState *cpu);
 
+/**
+ * tlb_flush_prot:
+ * @cpu: CPU whose TLB should be flushed
+ *
+ * Flush the entire TLB for the specified CPU, which must be the current
+ * one, after a change that only narrows the read/write permissions of
+ * existing mappings.  Since neither a virtual to physical translation
+ * nor an execute permission changes, the TBs found through the jump
+ * cache remain valid and, unlike with tlb_flush(), it is kept.
+ */
+void tlb_flush_prot(CPUState *cpu);
+
 /**
  * tlb_flush_all_cpus_synced:
  * @cpu: src CPU of the flush
@@ -239,6 +251,9 @@ static inline void tlb_flush_page_all_cpus_synced(CPUState *src, vaddr addr)
 static inline void tlb_flush(CPUState *cpu)
 {
 }
+static inline void tlb_flush_prot(CPUState *cpu)
+{
+}
 static inline void tlb_flush_all_cpus_synced(CPUState *src_cpu)
 {
 }
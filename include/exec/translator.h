@@ -20,6 +20,7 @@
 
 #include "qemu/bswap.h"
 #include "exec/vaddr.h"
+#include "tcg/tcg.h"
 
 /**
  * DisasJumpType:
@@ -158,6 +159,20 @@ void translator_loop(CPUState *cpu, TranslationBlock *tb, int *max_insns,
  */
 bool translator_use_goto_tb(DisasContextBase *db, vaddr dest);
 
+/**
+ * translator_goto_ptr
+ * @db: Disassembly context
+ * @dest: target pc of the jump, as cpu_get_tb_cpu_state() will return it
+ *
+ * End the TB with an indirect jump.  The cpu state must already hold
+ * @dest.  The caller must also ensure that nothing in the TB changed the
+ * state folded into the TB flags.  With that guarantee, the vCPU's jump
+ * cache is probed inline for a TB at @dest with the same cs_base, flags
+ * and cflags as this one, and helper_lookup_tb_ptr is called only on a
+ * miss.
+ */
+void translator_goto_ptr(DisasContextBase *db, TCGv_i64 dest);
+
 /**
  * translator_io_start
  * @db: Disassembly context
@@ -74,6 +74,15 @@ void tcg_gen_goto_tb(unsigned idx);
  */
 void tcg_gen_lookup_and_goto_ptr(void);
 
+/**
+ * tcg_gen_goto_ptr() - jump to the code of a TB found by the front end
+ * @ptr: The tc.ptr of a valid TB
+ *
+ * Like tcg_gen_lookup_and_goto_ptr(), but without calling the lookup
+ * helper.  Must not be used with CF_NO_GOTO_PTR.
+ */
+void tcg_gen_goto_ptr(TCGv_ptr ptr);
+
 void tcg_gen_plugin_cb(unsigned from);
 void tcg_gen_plugin_mem_cb(TCGv_i64 addr, unsigned meminfo);
 
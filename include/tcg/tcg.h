@@ -634,6 +634,9 @@ void tcg_pool_reset(TCGContext *s);
 TranslationBlock *tcg_tb_alloc(TCGContext *s);
 
 void tcg_region_reset_all(void);
+bool tcg_region_oldest_full(size_t *pidx);
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data);
+void tcg_region_release(size_t idx);
 
 size_t tcg_code_size(void);
 size_t tcg_code_capacity(void);
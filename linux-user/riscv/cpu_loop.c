@@ -75,6 +75,11 @@ void cpu_loop(CPURISCVState *env)
         case RISCV_EXCP_ILLEGAL_INST:
             force_sig_fault(TARGET_SIGILL, TARGET_ILL_ILLOPC, env->pc);
             break;
+        case RISCV_EXCP_LOAD_ACCESS_FAULT:
+        case RISCV_EXCP_STORE_AMO_ACCESS_FAULT:
+            /* Only raised by the HFI region checks, with no fault address */
+            force_sig_fault(TARGET_SIGSEGV, TARGET_SEGV_ACCERR, env->pc);
+            break;
         case RISCV_EXCP_BREAKPOINT:
         case EXCP_DEBUG:
         gdbstep:
@@ -24,6 +24,7 @@
 #include "cpu.h"
 #include "cpu_vendorid.h"
 #include "internals.h"
+#include "hfi_helper.h"
 #include "exec/exec-all.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
@@ -1128,22 +1129,18 @@ static void riscv_cpu_reset_hold(Object *obj, ResetType type)
     set_float_default_nan_pattern(0b01000000, &env->fp_status);
     env->vill = true;
 
-    for (int i = 0; i < HFI_NUM_DATA_REGIONS; i++) {
-        env->implicit_data_regions[i].prefix = 0;
-        env->implicit_data_regions[i].mask = 0xFFFFFFFFFFFFULL;  // 48-bit don't-care
-        env->implicit_data_regions[i].perm_read = false;
-        env->implicit_data_regions[i].perm_write = false;
-        env->implicit_data_regions[i].enabled = false;
-    }
-
-    for (int i = 0; i < HFI_NUM_CODE_REGIONS; i++) {
-        env->implicit_code_regions[i].prefix = 0;
-        env->implicit_code_regions[i].mask = 0xFFFFFFFFFFFFULL;  // 48-bit don't-care
-        env->implicit_code_regions[i].perm_exec = false;
-        env->implicit_code_regions[i].enabled = false;
+    env->hfi_status = 0;
+    env->hfi_exit_pc = 0;
+    env->hfi_region_type = 0;
+    for (int c = 0; c < HFI_MAX_CONTEXTS; c++) {
+        riscv_hfi_reset_ctx(&env->hfi_ctx[c]);
     }
+    env->hfi_cur_ctx = 0;
+    env->hfi_tlb_ctx = -1;
     
 #ifndef CONFIG_USER_ONLY
+    riscv_pwc_flush(env);
+
     if (cpu->cfg.debug) {
         riscv_trigger_reset_hold(env);
     }
@@ -2960,6 +2957,10 @@ static const Property riscv_cpu_properties[] = {
     {.name = "cbop_blocksize", .info = &prop_cbop_blksize},
     {.name = "cboz_blocksize", .info = &prop_cboz_blksize},
 
+    DEFINE_PROP_UINT8("hfi-data-regions", RISCVCPU, cfg.hfi_data_regions, 1),
+    DEFINE_PROP_UINT8("hfi-code-regions", RISCVCPU, cfg.hfi_code_regions, 1),
+    DEFINE_PROP_UINT8("hfi-contexts", RISCVCPU, cfg.hfi_contexts, 1),
+
     {.name = "mvendorid", .info = &prop_mvendorid},
     {.name = "mimpid", .info = &prop_mimpid},
     {.name = "marchid", .info = &prop_marchid},
@@ -3075,6 +3076,7 @@ static void riscv_cpu_common_class_init(ObjectClass *c, void *data)
 #ifndef CONFIG_USER_ONLY
     cc->sysemu_ops = &riscv_sysemu_ops;
     cc->get_arch_id = riscv_get_arch_id;
+    riscv_hfi_register_stats();
 #endif
     cc->gdb_arch_name = riscv_gdb_arch_name;
 
@@ -204,8 +204,22 @@ typedef struct PMUFixedCtrState {
 
 // HFI Structs 
 // TODO: could wrap with ifdef
-#define HFI_NUM_DATA_REGIONS 1 // double duty for implicit and explicit
-#define HFI_NUM_CODE_REGIONS 1
+/*
+ * Upper bound on the number of data regions (double duty for implicit and
+ * explicit) and of code regions.  The actual numbers are CPU properties,
+ * hfi-data-regions and hfi-code-regions.
+ */
+#define HFI_MAX_REGIONS 16
+
+/*
+ * Upper bound on the number of region contexts, see HFIContext.  The
+ * actual number is the hfi-contexts CPU property.
+ */
+#define HFI_MAX_CONTEXTS 8
+
+/* Values of hfi_region_type, as passed in rs1 of hfi_enter */
+#define HFI_REGION_TYPE_IMPLICIT 0
+#define HFI_REGION_TYPE_EXPLICIT 1
 
 /* Permission bit positions for explicit data regions (R1) */
 #define HFI_R1_ENABLED_BIT   7
@@ -222,20 +236,75 @@ typedef struct PMUFixedCtrState {
 #define HFI_R3_ENABLED_BIT   7
 #define HFI_R3_EXEC_BIT      6
 
-typedef struct HFIImplicitDataRegion {
-    uint64_t prefix;     // base prefix
-    uint64_t mask;       // lsb_mask 
-    bool perm_read;      // permission bit read
-    bool perm_write;     // permission bit write
-    bool enabled;        // enabled bit
-} HFIImplicitDataRegion;
-
-typedef struct HFIImplicitCodeRegion {
-    uint64_t prefix;     // base prefix
-    uint64_t mask;       // lsb_mask 
-    bool perm_exec;      // permission bit execute
-    bool enabled;        // enabled bit
-} HFIImplicitCodeRegion;
+/*
+ * Region tables are kept as structure-of-arrays: addresses in packed
+ * arrays, and enable/permission bits in bitmaps where bit i describes
+ * region i, so that finding the usable regions is a single AND.
+ */
+typedef struct HFIExplicitRegions {
+    uint64_t base[HFI_MAX_REGIONS];   // region base addresses
+    uint64_t bound[HFI_MAX_REGIONS];  // region sizes in bytes
+    uint16_t enabled;
+    uint16_t perm_read;
+    uint16_t perm_write;
+    uint16_t is_large;                // 64KiB granular base and bound
+} HFIExplicitRegions;
+
+typedef struct HFIImplicitRegions {
+    uint64_t prefix[HFI_MAX_REGIONS]; // base prefixes
+    uint64_t mask[HFI_MAX_REGIONS];   // lsb_masks
+    uint16_t enabled;
+    uint16_t perm_read;               // data regions only
+    uint16_t perm_write;              // data regions only
+    uint16_t perm_exec;               // code regions only
+} HFIImplicitRegions;
+
+/*
+ * A complete region table.  hfi_enter selects one by index, so a runtime
+ * can set up a context per sandbox once and switch between them without
+ * rewriting any region.  cfg_id is the key of the table in the TB
+ * flags, see riscv_hfi_update_cfg_id().
+ */
+typedef struct HFIContext {
+    HFIExplicitRegions explicit_data_regions; // r1
+    HFIImplicitRegions implicit_data_regions; // r2
+    HFIImplicitRegions implicit_code_regions; // r3
+    uint32_t cfg_id;
+} HFIContext;
+
+/*
+ * HFI statistics, reported by query-stats and "info hfi".  Bumped by
+ * generated code on sandbox transitions and at the start of each TB run
+ * inside the sandbox, and otherwise only on fault paths.  Fault counts
+ * by access type are indexed by is_store.  Implicit region faults have
+ * no region index, since they are raised when no region matches.
+ */
+typedef struct HFIStats {
+    uint64_t enter;
+    uint64_t exit;
+    uint64_t code_faults;
+    uint64_t implicit_data_faults[2];
+    uint64_t explicit_data_faults[2][HFI_MAX_REGIONS];
+    uint64_t sandbox_insns;   // insns executed inside the sandbox
+} HFIStats;
+
+/*
+ * Page-walk cache: non-leaf PTEs read by the page table walker, so that
+ * a TLB refill can start walking at the deepest table already known for
+ * the address.  Entries are keyed by the root table, the walk (mode and
+ * stage) and the VPN bits translated so far; like a hardware walk cache
+ * they are only dropped by sfence.vma, hfence.*, xatp writes and PMP
+ * changes.
+ */
+#define RISCV_PWC_SIZE 64
+
+typedef struct RISCVPWCEntry {
+    hwaddr root;            /* root table of the walk */
+    hwaddr next;            /* table for level + 1 */
+    target_ulong vpn;       /* VA bits translated by levels 0..level */
+    uint8_t level;
+    uint8_t walk;           /* mode and stage, 0 if the entry is free */
+} RISCVPWCEntry;
 
 struct CPUArchState {
     target_ulong gpr[32];
@@ -249,6 +318,13 @@ struct CPUArchState {
     target_ulong vstart;
     target_ulong vtype;
     bool vill;
+    /*
+     * Scratch register groups for the GVEC expansion of masked vector
+     * instructions: v0 expanded to one element mask per bit, and the
+     * result of the operation before it is merged into vd.
+     */
+    uint64_t vgvec_mask[8 * RV_VLEN_MAX / 64] QEMU_ALIGNED(16);
+    uint64_t vgvec_res[8 * RV_VLEN_MAX / 64] QEMU_ALIGNED(16);
 
     target_ulong pc;
     target_ulong load_res;
@@ -469,6 +545,9 @@ struct CPUArchState {
     pmp_table_t pmp_state;
     target_ulong mseccfg;
 
+    /* page-walk cache, see riscv_pwc_flush() */
+    RISCVPWCEntry pwc[RISCV_PWC_SIZE];
+
     /* trigger module */
     target_ulong trigger_cur;
     target_ulong tdata1[RV_MAX_TRIGGERS];
@@ -546,10 +625,14 @@ struct CPUArchState {
 
     // TODO: Change (for now assume only native sandboxing)
 
-    // TODO: Implement explicit data regions
-
-    HFIImplicitDataRegion implicit_data_regions[HFI_NUM_DATA_REGIONS]; // r2
-    HFIImplicitCodeRegion implicit_code_regions[HFI_NUM_CODE_REGIONS]; // r3
+    HFIContext hfi_ctx[HFI_MAX_CONTEXTS];
+    uint32_t hfi_cur_ctx;  // CSR, index into hfi_ctx
+    /*
+     * Context whose implicit data regions restrict every entry in the
+     * TLB, or -1 if some entry may be wider.  See riscv_hfi_flush_tlb().
+     */
+    int32_t hfi_tlb_ctx;
+    HFIStats hfi_stats;
 
     /*
     TODO: Implement a boolean array of data regions that have actually been
@@ -593,6 +676,8 @@ struct ArchCPU {
     uint32_t pmu_avail_ctrs;
     /* Mapping of events to counters */
     GHashTable *pmu_event_ctr_map;
+    /* RISCV_PMU_TCG_* events that are mapped to an enabled counter */
+    uint32_t pmu_tcg_events;
     const GPtrArray *decoders;
 };
 
@@ -665,6 +750,7 @@ void riscv_cpu_do_transaction_failed(CPUState *cs, hwaddr physaddr,
 hwaddr riscv_cpu_get_phys_page_debug(CPUState *cpu, vaddr addr);
 bool riscv_cpu_exec_interrupt(CPUState *cs, int interrupt_request);
 void riscv_cpu_swap_hypervisor_regs(CPURISCVState *env);
+void riscv_pwc_flush(CPURISCVState *env);
 int riscv_cpu_claim_interrupts(RISCVCPU *cpu, uint64_t interrupts);
 uint64_t riscv_cpu_update_mip(CPURISCVState *env, uint64_t mask,
                               uint64_t value);
@@ -689,6 +775,14 @@ void riscv_cpu_set_mode(CPURISCVState *env, target_ulong newpriv, bool virt_en);
 void riscv_ctr_add_entry(CPURISCVState *env, target_long src, target_long dst,
     enum CTRType type, target_ulong prev_priv, bool prev_virt);
 void riscv_ctr_clear(CPURISCVState *env);
+uint64_t riscv_ctr_tb_flags(CPURISCVState *env, uint64_t cs_base);
+
+/* How translated code records control transfers, see TB_FLAGS2.CTR_MODE */
+typedef enum {
+    CTR_TB_OFF,         /* Recording is off for the current mode */
+    CTR_TB_INLINE,      /* Filtered at translation time, stored inline */
+    CTR_TB_HELPER,      /* RAS emulation, left to riscv_ctr_add_entry() */
+} RISCVCTRTBMode;
 
 void riscv_translate_init(void);
 void riscv_translate_code(CPUState *cs, TranslationBlock *tb,
@@ -734,6 +828,22 @@ FIELD(TB_FLAGS, BCFI_ENABLED, 28, 1)
 FIELD(TB_FLAGS, PM_PMM, 29, 2)
 FIELD(TB_FLAGS, PM_SIGNEXTEND, 31, 1)
 
+/*
+ * TB_FLAGS is full, so state that only exists for the HFI sandbox, PMU
+ * event counting and control transfer records is carried in cs_base,
+ * which is otherwise unused on RISC-V.
+ */
+FIELD(TB_FLAGS2, HFI_ENABLED, 0, 1)
+FIELD(TB_FLAGS2, HFI_REGION_TYPE, 1, 2)
+/* RISCV_PMU_TCG_* events that translated code has to count */
+FIELD(TB_FLAGS2, PMU_EVENTS, 3, 3)
+/* Smctr/Ssctr state for transfers within the current mode */
+FIELD(TB_FLAGS2, CTR_MODE, 6, 2)
+FIELD(TB_FLAGS2, CTR_DEPTH, 8, 3)
+FIELD(TB_FLAGS2, CTR_INH, 11, 16)
+/* Id of the region table, so region checks can use translation-time values */
+FIELD(TB_FLAGS2, HFI_CFG_ID, 32, 32)
+
 #ifdef TARGET_RISCV32
 #define riscv_cpu_mxl(env)  ((void)(env), MXL_RV32)
 #else
@@ -897,6 +1007,7 @@ RISCVException riscv_csrrw_debug(CPURISCVState *env, int csrno,
                                  target_ulong *ret_value,
                                  target_ulong new_value,
                                  target_ulong write_mask);
+target_ulong riscv_sstatus_read_mask(const RISCVCPUConfig *cfg, bool uxl);
 
 static inline void riscv_csr_write(CPURISCVState *env, int csrno,
                                    target_ulong val)
@@ -958,11 +1069,29 @@ enum {
 enum riscv_pmu_event_idx {
     RISCV_PMU_EVENT_HW_CPU_CYCLES = 0x01,
     RISCV_PMU_EVENT_HW_INSTRUCTIONS = 0x02,
+    RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS = 0x05,
+    RISCV_PMU_EVENT_CACHE_L1D_READ_ACCESS = 0x10000,
+    RISCV_PMU_EVENT_CACHE_L1D_WRITE_ACCESS = 0x10002,
     RISCV_PMU_EVENT_CACHE_DTLB_READ_MISS = 0x10019,
     RISCV_PMU_EVENT_CACHE_DTLB_WRITE_MISS = 0x1001B,
     RISCV_PMU_EVENT_CACHE_ITLB_PREFETCH_MISS = 0x10021,
 };
 
+/* Events counted by translated code, see TB_FLAGS2 PMU_EVENTS */
+#define RISCV_PMU_TCG_LOAD      BIT(0)
+#define RISCV_PMU_TCG_STORE     BIT(1)
+#define RISCV_PMU_TCG_BRANCH    BIT(2)
+
+/*
+ * Events of an insn and of the rest of its TB, kept in the high half of
+ * insn_start word 1.  A TB adds all of its events on entry, and
+ * riscv_restore_state_to_opc() takes these back for an insn that does not
+ * complete.  A TB has at most TCG_MAX_INSNS insns, so each count fits.
+ */
+FIELD(PMU_TB_TAIL, LOADS, 0, 10)
+FIELD(PMU_TB_TAIL, STORES, 10, 10)
+FIELD(PMU_TB_TAIL, BRANCHES, 20, 10)
+
 /* used by tcg/tcg-cpu.c*/
 void isa_ext_update_enabled(RISCVCPU *cpu, uint32_t ext_offset, bool en);
 bool isa_ext_is_enabled(RISCVCPU *cpu, uint32_t ext_offset);
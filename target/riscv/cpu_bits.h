@@ -549,6 +549,7 @@
 
 /* HFI Extension */
 #define CSR_HFI_STATUS      0x7C0  // HFI status register
+#define CSR_HFI_CONTEXT     0x7C1  // HFI current region context
 
 /* mstatus CSR bits */
 #define MSTATUS_UIE         0x00000001
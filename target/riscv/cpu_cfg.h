@@ -189,6 +189,9 @@ struct RISCVCPUConfig {
     uint16_t cbom_blocksize;
     uint16_t cbop_blocksize;
     uint16_t cboz_blocksize;
+    uint8_t hfi_data_regions;
+    uint8_t hfi_code_regions;
+    uint8_t hfi_contexts;
     bool mmu;
     bool pmp;
     bool debug;
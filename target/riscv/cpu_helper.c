@@ -35,6 +35,7 @@
 #include "cpu_bits.h"
 #include "debug.h"
 #include "pmp.h"
+#include "hfi_helper.h"
 
 int riscv_env_mmu_index(CPURISCVState *env, bool ifetch)
 {
@@ -228,6 +229,25 @@ void cpu_get_tb_cpu_state(CPURISCVState *env, vaddr *pc,
     flags = FIELD_DP32(flags, TB_FLAGS, PM_PMM, riscv_pm_get_pmm(env));
     flags = FIELD_DP32(flags, TB_FLAGS, PM_SIGNEXTEND, pm_signext);
 
+    /*
+     * Fold the sandbox state into the TB key, so that code translated
+     * outside of a sandbox carries no HFI checks at all.
+     */
+    if (env->hfi_status == 1) {
+        *cs_base = FIELD_DP64(*cs_base, TB_FLAGS2, HFI_ENABLED, 1);
+        *cs_base = FIELD_DP64(*cs_base, TB_FLAGS2, HFI_REGION_TYPE,
+                              MIN(env->hfi_region_type, 3));
+        *cs_base = FIELD_DP64(*cs_base, TB_FLAGS2, HFI_CFG_ID,
+                              riscv_hfi_ctx(env)->cfg_id);
+    }
+    *cs_base = FIELD_DP64(*cs_base, TB_FLAGS2, PMU_EVENTS,
+                          cpu->pmu_tcg_events);
+#ifndef CONFIG_USER_ONLY
+    if (cpu->cfg.ext_smctr || cpu->cfg.ext_ssctr) {
+        *cs_base = riscv_ctr_tb_flags(env, *cs_base);
+    }
+#endif
+
     *pflags = flags;
 }
 
@@ -1124,6 +1144,34 @@ void riscv_ctr_add_entry(CPURISCVState *env, target_long src, target_long dst,
     env->sctrstatus = set_field(env->sctrstatus, SCTRSTATUS_WRPTR_MASK, head);
 }
 
+/*
+ * Translated code only records transfers that stay within the current
+ * mode, for which riscv_ctr_add_entry() depends on nothing but the control
+ * register of that mode, sctrdepth and sctrstatus.FROZEN. Fold those into
+ * the TB flags so the filtering happens at translation time. All of them
+ * only change on CSR writes and traps, which end the TB.
+ */
+uint64_t riscv_ctr_tb_flags(CPURISCVState *env, uint64_t cs_base)
+{
+    uint64_t mask = riscv_ctr_priv_to_mask(env->priv, env->virt_enabled);
+    uint64_t ctrl = riscv_ctr_get_control(env, env->priv, env->virt_enabled);
+    RISCVCTRTBMode mode;
+
+    if (!(ctrl & mask) || env->sctrstatus & SCTRSTATUS_FROZEN) {
+        mode = CTR_TB_OFF;
+    } else if (ctrl & XCTRCTL_RASEMU) {
+        mode = CTR_TB_HELPER;
+    } else {
+        mode = CTR_TB_INLINE;
+        cs_base = FIELD_DP64(cs_base, TB_FLAGS2, CTR_DEPTH,
+                             get_field(env->sctrdepth, SCTRDEPTH_MASK));
+        cs_base = FIELD_DP64(cs_base, TB_FLAGS2, CTR_INH,
+                             extract64(ctrl, XCTRCTL_INH_START, 16));
+    }
+
+    return FIELD_DP64(cs_base, TB_FLAGS2, CTR_MODE, mode);
+}
+
 void riscv_cpu_set_mode(CPURISCVState *env, target_ulong newpriv, bool virt_en)
 {
     g_assert(newpriv <= PRV_M && newpriv != PRV_RESERVED);
@@ -1209,6 +1257,61 @@ static int get_physical_address_pmp(CPURISCVState *env, int *prot, hwaddr addr,
     return TRANSLATE_SUCCESS;
 }
 
+/*
+ * get_physical_address_hfi - restrict a TLB entry to the HFI implicit
+ * data regions, which are checked against the virtual address.
+ *
+ * Returns the page protection to apply, or 0 if the access itself is
+ * not permitted by any region.  Regions are aligned prefix/mask blocks;
+ * only those covering the whole TLB page contribute to the protection of
+ * the entry.  If the access is only permitted by a region that covers
+ * part of the page, *tlb_size is cut down so that every access to the
+ * page comes back here.  Execute permission is left to the TB-level
+ * code region check.
+ */
+static int get_physical_address_hfi(CPURISCVState *env, vaddr addr, int size,
+                                    MMUAccessType access_type,
+                                    hwaddr *tlb_size)
+{
+    vaddr page = addr & ~(*tlb_size - 1);
+    vaddr page_last = page + *tlb_size - 1;
+    vaddr last = addr + MAX(size, 1) - 1;
+    int need = 0;
+    int page_prot = 0;
+    int access_prot = 0;
+
+    if (access_type == MMU_DATA_LOAD) {
+        need = PAGE_READ;
+    } else if (access_type == MMU_DATA_STORE) {
+        need = PAGE_WRITE;
+    }
+
+    const HFIImplicitRegions *r = &riscv_hfi_ctx(env)->implicit_data_regions;
+    uint32_t usable = r->enabled & (r->perm_read | r->perm_write);
+
+    for (; usable; usable &= usable - 1) {
+        int i = ctz32(usable);
+        int prot = (r->perm_read & BIT(i) ? PAGE_READ : 0) |
+                   (r->perm_write & BIT(i) ? PAGE_WRITE : 0);
+
+        if (hfi_implicit_match(r, i, page, page_last)) {
+            page_prot |= prot;
+        }
+        if (hfi_implicit_match(r, i, addr, last)) {
+            access_prot |= prot;
+        }
+    }
+
+    if ((access_prot & need) != need) {
+        return 0;
+    }
+    if ((page_prot & need) != need) {
+        *tlb_size = 1;
+        return access_prot | PAGE_EXEC;
+    }
+    return page_prot | PAGE_EXEC;
+}
+
 /* Returns 'true' if a svukte address check is needed */
 static bool do_svukte_check(CPURISCVState *env, bool first_stage,
                              int mode, bool virt)
@@ -1258,6 +1361,52 @@ static bool check_svukte_addr(CPURISCVState *env, vaddr addr)
     return !high_bit;
 }
 
+void riscv_pwc_flush(CPURISCVState *env)
+{
+    memset(env->pwc, 0, sizeof(env->pwc));
+}
+
+static RISCVPWCEntry *pwc_entry(CPURISCVState *env, hwaddr root,
+                                target_ulong vpn, int level)
+{
+    return &env->pwc[(vpn ^ (root >> PGSHIFT) ^ (level << 4)) &
+                     (RISCV_PWC_SIZE - 1)];
+}
+
+/*
+ * Find the deepest table of the walk already known for addr.  Returns the
+ * level to start walking at, with *base set to its table, or 0 if none.
+ */
+static int pwc_lookup(CPURISCVState *env, uint8_t walk, hwaddr root,
+                      vaddr addr, int levels, int ptidxbits, hwaddr *base)
+{
+    for (int level = levels - 2; level >= 0; level--) {
+        target_ulong vpn = addr >> (PGSHIFT + (levels - 1 - level) * ptidxbits);
+        RISCVPWCEntry *e = pwc_entry(env, root, vpn, level);
+
+        if (e->walk == walk && e->root == root &&
+            e->level == level && e->vpn == vpn) {
+            *base = e->next;
+            return level + 1;
+        }
+    }
+    return 0;
+}
+
+static void pwc_insert(CPURISCVState *env, uint8_t walk, hwaddr root,
+                       vaddr addr, int level, int ptshift, hwaddr next)
+{
+    target_ulong vpn = addr >> (PGSHIFT + ptshift);
+
+    *pwc_entry(env, root, vpn, level) = (RISCVPWCEntry) {
+        .root = root,
+        .next = next,
+        .vpn = vpn,
+        .level = level,
+        .walk = walk,
+    };
+}
+
 /*
  * get_physical_address - get the physical address for this virtual address
  *
@@ -1411,13 +1560,25 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
         adue = adue && (env->henvcfg & HENVCFG_ADUE);
     }
 
-    int ptshift = (levels - 1) * ptidxbits;
+    /* Never 0: Bare was handled above, and vm needs at most 4 bits. */
+    uint8_t walk = vm | first_stage << 4 | two_stage << 5;
+    hwaddr root = base;
+    int ptshift;
     target_ulong pte;
     hwaddr pte_addr;
     int i;
 
  restart:
-    for (i = 0; i < levels; i++, ptshift -= ptidxbits) {
+    /*
+     * Skip the levels held by the page-walk cache.  It belongs to the
+     * vCPU thread, so debug accesses (gdbstub, monitor) neither use nor
+     * fill it.
+     */
+    base = root;
+    i = is_debug ? 0 : pwc_lookup(env, walk, root, addr, levels, ptidxbits,
+                                  &base);
+    ptshift = (levels - 1 - i) * ptidxbits;
+    for (; i < levels; i++, ptshift -= ptidxbits) {
         target_ulong idx;
         if (i == 0) {
             idx = (addr >> (PGSHIFT + ptshift)) &
@@ -1518,6 +1679,9 @@ static int get_physical_address(CPURISCVState *env, hwaddr *physical,
         }
         /* Inner PTE, continue walking */
         base = ppn << PGSHIFT;
+        if (!is_debug) {
+            pwc_insert(env, walk, root, addr, i, ptshift, base);
+        }
     }
 
     /* No leaf pte at any translation level. */
@@ -1961,6 +2125,29 @@ bool riscv_cpu_tlb_fill(CPUState *cs, vaddr address, int size,
         }
     }
 
+    if (ret == TRANSLATE_SUCCESS && !riscv_hfi_data_checks_enabled(env)) {
+        /* The entry may be wider than a sandbox allows, see hfi_enter. */
+        env->hfi_tlb_ctx = -1;
+    } else if (ret == TRANSLATE_SUCCESS) {
+        int prot_hfi = get_physical_address_hfi(env, address, size,
+                                                access_type, &tlb_size);
+
+        qemu_log_mask(CPU_LOG_MMU,
+                      "%s HFI address=%" VADDR_PRIx " prot %d tlb_size %"
+                      HWADDR_PRIu "\n", __func__, address, prot_hfi, tlb_size);
+
+        if (prot_hfi) {
+            prot &= prot_hfi;
+        } else {
+            /* Report a region violation as an access fault, like PMP. */
+            ret = TRANSLATE_PMP_FAIL;
+            if (!probe) {
+                env->hfi_stats.implicit_data_faults[
+                    access_type == MMU_DATA_STORE]++;
+            }
+        }
+    }
+
     if (ret == TRANSLATE_PMP_FAIL) {
         pmp_violation = true;
     }
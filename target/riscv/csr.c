@@ -30,6 +30,7 @@
 #include "system/cpu-timers.h"
 #include "qemu/guest-random.h"
 #include "qapi/error.h"
+#include "hfi_helper.h"
 #include <stdbool.h>
 
 /* CSR function table public API */
@@ -1941,6 +1942,7 @@ static target_ulong legalize_xatp(CPURISCVState *env, target_ulong old_xatp,
          * enabled avoids leaking those invalid cached mappings.
          */
         tlb_flush(env_cpu(env));
+        riscv_pwc_flush(env);
         return val;
     }
     return old_xatp;
@@ -3047,6 +3049,8 @@ static RISCVException write_mcountinhibit(CPURISCVState *env, int csrno,
         }
     }
 
+    riscv_pmu_update_tcg_events(env);
+
     return RISCV_EXCP_NONE;
 }
 
@@ -3856,20 +3860,30 @@ static RISCVException read_sstatus_i128(CPURISCVState *env, int csrno,
     return RISCV_EXCP_NONE;
 }
 
-static RISCVException read_sstatus(CPURISCVState *env, int csrno,
-                                   target_ulong *val)
+/* Bits of mstatus that read_sstatus() exposes, also used by translate.c */
+target_ulong riscv_sstatus_read_mask(const RISCVCPUConfig *cfg, bool uxl)
 {
     target_ulong mask = (sstatus_v1_10_mask);
-    if (env->xl != MXL_RV32 || env->debugger) {
+    if (uxl) {
         mask |= SSTATUS64_UXL;
     }
 
-    if (env_archcpu(env)->cfg.ext_zicfilp) {
+    if (cfg->ext_zicfilp) {
         mask |= SSTATUS_SPELP;
     }
-    if (riscv_cpu_cfg(env)->ext_ssdbltrp) {
+    if (cfg->ext_ssdbltrp) {
         mask |= SSTATUS_SDT;
     }
+    return mask;
+}
+
+static RISCVException read_sstatus(CPURISCVState *env, int csrno,
+                                   target_ulong *val)
+{
+    target_ulong mask =
+        riscv_sstatus_read_mask(riscv_cpu_cfg(env),
+                                env->xl != MXL_RV32 || env->debugger);
+
     /* TODO: Use SXL not MXL. */
     *val = add_status_sd(riscv_cpu_mxl(env), env->mstatus & mask);
     return RISCV_EXCP_NONE;
@@ -5740,6 +5754,25 @@ static RISCVException hfi_status_read(CPURISCVState *env, int csrno, target_ulon
 static RISCVException hfi_status_write(CPURISCVState *env, int csrno, target_ulong new_value)
 {
     env->hfi_status = new_value;
+    riscv_hfi_flush_tlb(env);
+    return RISCV_EXCP_NONE;
+}
+
+static RISCVException hfi_context_read(CPURISCVState *env, int csrno,
+                                       target_ulong *ret_value)
+{
+    *ret_value = env->hfi_cur_ctx;
+    return RISCV_EXCP_NONE;
+}
+
+/* Selects the context edited by hfi_set_region_*, and used by a sandbox */
+static RISCVException hfi_context_write(CPURISCVState *env, int csrno,
+                                        target_ulong new_value)
+{
+    if (new_value < riscv_cpu_cfg(env)->hfi_contexts) {
+        env->hfi_cur_ctx = new_value;
+        riscv_hfi_flush_tlb(env);
+    }
     return RISCV_EXCP_NONE;
 }
 
@@ -6493,5 +6526,7 @@ riscv_csr_operations csr_ops[CSR_TABLE_SIZE] = {
     /* HFI CSRs */
     [CSR_HFI_STATUS]   = { "hfi_status",   hfi,  hfi_status_read, 
                             hfi_status_write },
+    [CSR_HFI_CONTEXT]  = { "hfi_context",  hfi,  hfi_context_read,
+                            hfi_context_write },
 
 };
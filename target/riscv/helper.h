@@ -121,6 +121,9 @@ DEF_HELPER_2(cbo_clean_flush, void, env, tl)
 DEF_HELPER_2(cbo_inval, void, env, tl)
 DEF_HELPER_2(cbo_zero, void, env, tl)
 
+/* Misaligned Zama16b AMOs */
+DEF_HELPER_5(amo_within16, tl, env, tl, tl, i32, i32)
+
 /* Special functions */
 DEF_HELPER_2(csrr, tl, env, int)
 DEF_HELPER_3(csrw, void, env, int, tl)
@@ -138,6 +141,7 @@ DEF_HELPER_1(wrs_nto, void, env)
 DEF_HELPER_1(tlb_flush, void, env)
 DEF_HELPER_1(tlb_flush_all, void, env)
 DEF_HELPER_4(ctr_add_entry, void, env, tl, tl, tl)
+DEF_HELPER_FLAGS_4(pmu_count_events, TCG_CALL_NO_RWG, void, env, i32, i32, i32)
 /* Native Debug */
 DEF_HELPER_1(itrigger_match, void, env)
 #endif
@@ -268,6 +272,7 @@ DEF_HELPER_FLAGS_4(vec_rsubs8, TCG_CALL_NO_RWG, void, ptr, ptr, i64, i32)
 DEF_HELPER_FLAGS_4(vec_rsubs16, TCG_CALL_NO_RWG, void, ptr, ptr, i64, i32)
 DEF_HELPER_FLAGS_4(vec_rsubs32, TCG_CALL_NO_RWG, void, ptr, ptr, i64, i32)
 DEF_HELPER_FLAGS_4(vec_rsubs64, TCG_CALL_NO_RWG, void, ptr, ptr, i64, i32)
+DEF_HELPER_FLAGS_3(vmask_expand, TCG_CALL_NO_RWG, void, ptr, ptr, i32)
 
 DEF_HELPER_6(vwaddu_vv_b, void, ptr, ptr, ptr, ptr, env, i32)
 DEF_HELPER_6(vwaddu_vv_h, void, ptr, ptr, ptr, ptr, env, i32)
@@ -1288,8 +1293,11 @@ DEF_HELPER_4(vsm4r_vs, void, ptr, ptr, env, i32)
 /* HFI - might need guard */
 DEF_HELPER_7(hfi_log, void, env, i64, i64, i64, i64, i64, i64)
 DEF_HELPER_3(hfi_trap_log, void, env, i64, i64)
-DEF_HELPER_3(hfi_enter, void, env, i64, i64)
-DEF_HELPER_1(hfi_exit, void, env)
+DEF_HELPER_1(hfi_code_fault, noreturn, env)
+DEF_HELPER_2(hfi_code_recheck, noreturn, env, i32)
+DEF_HELPER_3(hfi_data_fault, noreturn, env, i32, s32)
+DEF_HELPER_1(hfi_flush_tlb, void, env)
+DEF_HELPER_1(hfi_log_transition, void, env)
 DEF_HELPER_4(hfi_set_region_size, void, env, i64, i64, i64)
 DEF_HELPER_3(hfi_set_region_permissions, void, env, i64, i64)
 DEF_HELPER_1(hfi_print, void, env)
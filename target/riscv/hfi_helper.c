@@ -1,5 +1,10 @@
 #include "hfi_helper.h"
 #include "qemu/log.h"
+#include "exec/exec-all.h"
+#include "exec/cputlb.h"
+#include "exec/tb-flush.h"
+#include "system/tcg.h"
+#include "qemu/xxhash.h"
 #include "trace.h"
 
 void helper_hfi_log(CPURISCVState *env, uint64_t addr, uint64_t prefix, uint64_t mask,
@@ -11,7 +16,7 @@ void helper_hfi_log(CPURISCVState *env, uint64_t addr, uint64_t prefix, uint64_t
         case 2: type_str = "internal"; break;
     }
 
-    qemu_log_mask(LOG_UNIMP,
+    qemu_log_mask(CPU_LOG_HFI,
         "HFI: [%s region %d] addr=0x%016" PRIx64 " & mask=0x%016" PRIx64
         " → 0x%016" PRIx64 ", expecting prefix=0x%016" PRIx64 " → match=%d\n",
         type_str, region, addr, mask, addr & mask, prefix, matched);
@@ -27,128 +32,385 @@ void helper_hfi_trap_log(CPURISCVState *env, uint64_t access_type, uint64_t regi
         case 2: rtype = "internal"; break;
     }
 
-    qemu_log_mask(LOG_UNIMP, "HFI: trap → no %s permission matched in %s region\n", atype, rtype);
+    qemu_log_mask(CPU_LOG_HFI, "HFI: trap → no %s permission matched in %s region\n", atype, rtype);
 }
 
+void riscv_hfi_flush_tlb(CPURISCVState *env)
+{
+    /*
+     * Entries filled inside the sandbox only ever have a subset of the
+     * permissions of those filled outside, and a missing permission just
+     * causes a refill, so leaving the sandbox needs no flush.  Only data
+     * permissions are narrowed, so the jump cache can be kept.
+     */
+    if (riscv_hfi_data_checks_enabled(env)) {
+        tlb_flush_prot(env_cpu(env));
+        env->hfi_tlb_ctx = env->hfi_cur_ctx;
+    }
+}
+
+QEMU_BUILD_BUG_ON(HFI_MAX_REGIONS > 16);
+
+/*
+ * Region tables by content.  Each distinct table is given an id when it
+ * is first seen, and that id, not a hash, is what goes into the TB key:
+ * two tables never share an id, so a TB is only ever found for the table
+ * that its region checks were generated from.
+ *
+ * Ids are not recycled while the registry holds a table.  Once it grows
+ * to HFI_CFG_MAX tables, everything is flushed and renumbered from zero.
+ */
+#define HFI_CFG_MAX 4096
+
+static QemuMutex hfi_cfg_lock;
+static GHashTable *hfi_cfgs;
+static uint32_t hfi_cfg_next_id;
+static bool hfi_cfg_reset_pending;
+
+static void hfi_cfg_copy_implicit(HFIImplicitRegions *d,
+                                  const HFIImplicitRegions *s)
+{
+    d->enabled = s->enabled;
+    d->perm_read = s->perm_read & s->enabled;
+    d->perm_write = s->perm_write & s->enabled;
+    d->perm_exec = s->perm_exec & s->enabled;
+    for (uint32_t m = s->enabled; m; m &= m - 1) {
+        int i = ctz32(m);
+        d->prefix[i] = s->prefix[i];
+        d->mask[i] = s->mask[i];
+    }
+}
+
+/*
+ * The part of hc that generated code depends on, with everything else
+ * zero.  Disabled regions never match, so their addresses are left out.
+ * Under softmmu the implicit data regions are only checked at TLB fill,
+ * not by generated code.
+ */
+static void hfi_cfg_canonicalize(HFIContext *key, const HFIContext *hc)
+{
+    const HFIExplicitRegions *er = &hc->explicit_data_regions;
+    HFIExplicitRegions *ker = &key->explicit_data_regions;
+
+    memset(key, 0, sizeof(*key));
+    ker->enabled = er->enabled;
+    ker->perm_read = er->perm_read & er->enabled;
+    ker->perm_write = er->perm_write & er->enabled;
+    ker->is_large = er->is_large & er->enabled;
+    for (uint32_t m = er->enabled; m; m &= m - 1) {
+        int i = ctz32(m);
+        ker->base[i] = er->base[i];
+        ker->bound[i] = er->bound[i];
+    }
+#ifdef CONFIG_USER_ONLY
+    hfi_cfg_copy_implicit(&key->implicit_data_regions,
+                          &hc->implicit_data_regions);
+#endif
+    hfi_cfg_copy_implicit(&key->implicit_code_regions,
+                          &hc->implicit_code_regions);
+}
+
+static guint hfi_cfg_hash(gconstpointer p)
+{
+    const HFIContext *key = p;
+    const HFIExplicitRegions *er = &key->explicit_data_regions;
+    const HFIImplicitRegions *dr = &key->implicit_data_regions;
+    const HFIImplicitRegions *cr = &key->implicit_code_regions;
+    uint32_t h = 0;
+
+    h = qemu_xxhash6(er->enabled, er->perm_read | er->perm_write << 16,
+                     er->is_large, h);
+    for (uint32_t m = er->enabled; m; m &= m - 1) {
+        int i = ctz32(m);
+        h = qemu_xxhash6(er->base[i], er->bound[i], i, h);
+    }
+    h = qemu_xxhash6(dr->enabled, dr->perm_read | dr->perm_write << 16, 1, h);
+    for (uint32_t m = dr->enabled; m; m &= m - 1) {
+        int i = ctz32(m);
+        h = qemu_xxhash6(dr->prefix[i], dr->mask[i], i, h);
+    }
+    h = qemu_xxhash6(cr->enabled, cr->perm_exec, 2, h);
+    for (uint32_t m = cr->enabled; m; m &= m - 1) {
+        int i = ctz32(m);
+        h = qemu_xxhash6(cr->prefix[i], cr->mask[i], i, h);
+    }
+    return h;
+}
+
+static gboolean hfi_cfg_equal(gconstpointer a, gconstpointer b)
+{
+    return !memcmp(a, b, offsetof(HFIContext, cfg_id));
+}
+
+void riscv_hfi_init(void)
+{
+    qemu_mutex_init(&hfi_cfg_lock);
+    hfi_cfgs = g_hash_table_new_full(hfi_cfg_hash, hfi_cfg_equal,
+                                     g_free, NULL);
+}
+
+/*
+ * Runs with every vCPU stopped, so once all TBs are flushed and every
+ * context is renumbered, no TB keyed on an old id can be found.
+ */
+static void hfi_cfg_reset(CPUState *cpu, run_on_cpu_data data)
+{
+    CPUState *cs;
+
+    tb_flush(cpu);
+
+    qemu_mutex_lock(&hfi_cfg_lock);
+    g_hash_table_remove_all(hfi_cfgs);
+    hfi_cfg_next_id = 0;
+    hfi_cfg_reset_pending = false;
+    qemu_mutex_unlock(&hfi_cfg_lock);
+
+    CPU_FOREACH(cs) {
+        CPURISCVState *env = cpu_env(cs);
+
+        for (int c = 0; c < HFI_MAX_CONTEXTS; c++) {
+            riscv_hfi_update_cfg_id(&env->hfi_ctx[c]);
+        }
+    }
+}
 
-void helper_hfi_enter(CPURISCVState *env, uint64_t region_type, uint64_t exit_handler)
+void riscv_hfi_update_cfg_id(HFIContext *hc)
 {
-    /* Set HFI sandbox active: status = 1 and record the 64-bit exit handler */
-    env->hfi_status = 1;
-    env->hfi_exit_pc = exit_handler;
-    env->hfi_region_type = region_type;
+    HFIContext key, *e;
 
-    qemu_log_mask(LOG_UNIMP, "HFI: Enter sandbox mode, region_type=%llu, exit_handler=0x%016" PRIx64 "\n", 
-                 region_type, exit_handler);
+    /* Only translated code is keyed on the id. */
+    if (!tcg_enabled()) {
+        hc->cfg_id = 0;
+        return;
+    }
+
+    hfi_cfg_canonicalize(&key, hc);
+
+    qemu_mutex_lock(&hfi_cfg_lock);
+    e = g_hash_table_lookup(hfi_cfgs, &key);
+    if (!e) {
+        e = g_memdup2(&key, sizeof(key));
+        e->cfg_id = hfi_cfg_next_id++;
+        g_hash_table_add(hfi_cfgs, e);
+        /*
+         * Queue the reset on the vCPU that is running us, which is sure
+         * to get back to its loop soon.  Without one, as on reset or on
+         * incoming migration, the next vCPU to add a table queues it.
+         */
+        if (g_hash_table_size(hfi_cfgs) >= HFI_CFG_MAX &&
+            !hfi_cfg_reset_pending && current_cpu) {
+            hfi_cfg_reset_pending = true;
+            async_safe_run_on_cpu(current_cpu, hfi_cfg_reset,
+                                  RUN_ON_CPU_NULL);
+        }
+    }
+    hc->cfg_id = e->cfg_id;
+    qemu_mutex_unlock(&hfi_cfg_lock);
+}
+
+/* Every region disabled, with 48-bit don't-care masks. */
+static const HFIContext hfi_reset_ctx = {
+    .implicit_data_regions.mask = {
+        [0 ... HFI_MAX_REGIONS - 1] = 0xFFFFFFFFFFFFULL
+    },
+    .implicit_code_regions.mask = {
+        [0 ... HFI_MAX_REGIONS - 1] = 0xFFFFFFFFFFFFULL
+    },
+};
+
+void riscv_hfi_reset_ctx(HFIContext *hc)
+{
+    *hc = hfi_reset_ctx;
+    riscv_hfi_update_cfg_id(hc);
+}
+
+bool riscv_hfi_ctx_is_reset(const HFIContext *hc)
+{
+    return !memcmp(hc, &hfi_reset_ctx, offsetof(HFIContext, cfg_id));
+}
+
+void helper_hfi_code_fault(CPURISCVState *env)
+{
+    env->hfi_stats.code_faults++;
+    helper_hfi_trap_log(env, 0, 2);
+    riscv_raise_exception(env, RISCV_EXCP_LOAD_ACCESS_FAULT, GETPC());
+}
+
+void helper_hfi_data_fault(CPURISCVState *env, uint32_t exception,
+                           int32_t region)
+{
+    bool is_store = exception == RISCV_EXCP_STORE_AMO_ACCESS_FAULT;
+
+    if (region < 0) {
+        env->hfi_stats.implicit_data_faults[is_store]++;
+    } else {
+        env->hfi_stats.explicit_data_faults[is_store][region]++;
+    }
+    helper_hfi_trap_log(env, is_store, region < 0 ? 1 : 0);
+    riscv_raise_exception(env, exception, GETPC());
 }
 
-void helper_hfi_exit(CPURISCVState *env)
+void helper_hfi_code_recheck(CPURISCVState *env, uint32_t cflags)
 {
-    /* Reset HFI sandbox state: status = 0 and clear the exit handler */
-    env->hfi_status = 0;
+    CPUState *cs = env_cpu(env);
+
+    /* No insn of the TB has run yet: this restores the pc of the first. */
+    cpu_restore_state(cs, GETPC());
+    cs->cflags_next_tb = cflags;
+    cpu_loop_exit_noexc(cs);
+}
 
-    // might want to reenter with same state
-    // env->hfi_exit_pc = 0;
-    // env->hfi_region_type = 0; 
-    qemu_log_mask(LOG_UNIMP, "HFI: Exited sandbox mode\n");
+void helper_hfi_flush_tlb(CPURISCVState *env)
+{
+    riscv_hfi_flush_tlb(env);
+}
+
+void helper_hfi_log_transition(CPURISCVState *env)
+{
+    if (env->hfi_status == 1) {
+        qemu_log_mask(CPU_LOG_HFI, "HFI: Enter sandbox mode, context=%u, "
+                      "region_type=%" PRIu64 ", exit_handler=0x%016" PRIx64 "\n",
+                      env->hfi_cur_ctx, env->hfi_region_type,
+                      env->hfi_exit_pc);
+    } else {
+        qemu_log_mask(CPU_LOG_HFI, "HFI: Exited sandbox mode\n");
+    }
 }
 
+/*
+ * Region numbers are laid out as
+ *   explicit data regions:  [0, n_data)
+ *   implicit data regions:  [n_data, 2 * n_data)
+ *   implicit code regions:  [2 * n_data, 2 * n_data + n_code)
+ * where n_data and n_code are the hfi-data-regions and hfi-code-regions
+ * CPU properties.
+ */
 void helper_hfi_set_region_size(CPURISCVState *env, uint64_t region_number, 
                                uint64_t base, uint64_t mask_or_bound)
 {
-    /* Check for explicit data regions: 0 <= region_number < HFI_NUM_DATA_REGIONS */
-    if (region_number < HFI_NUM_DATA_REGIONS) {
-        /* 
-         * TODO: Explicit data regions are not yet implemented.
-         */
-        qemu_log_mask(LOG_UNIMP, "HFI: Explicit data region %d not yet implemented\n", 
-                     region_number);
+    uint64_t n_data = riscv_cpu_cfg(env)->hfi_data_regions;
+    uint64_t n_code = riscv_cpu_cfg(env)->hfi_code_regions;
+    HFIContext *hc = riscv_hfi_ctx(env);
+
+    /* Check for explicit data regions: 0 <= region_number < n_data */
+    if (region_number < n_data) {
+        /* For explicit data region */
+        hc->explicit_data_regions.base[region_number] = base;
+        hc->explicit_data_regions.bound[region_number] = mask_or_bound;
+        riscv_hfi_update_cfg_id(hc);
+        qemu_log_mask(CPU_LOG_HFI, "HFI: Set explicit data region %d size: base=0x%016" PRIx64
+                     ", bound=0x%016" PRIx64 "\n",
+                     (int)region_number, base, mask_or_bound);
     } 
-    /* Check for implicit data regions: HFI_NUM_DATA_REGIONS <= region_number < 2*HFI_NUM_DATA_REGIONS */
-    else if (region_number < 2 * HFI_NUM_DATA_REGIONS) {
-        /* Calculate index into implicit_data_regions array */
-        uint64_t idx = region_number - HFI_NUM_DATA_REGIONS;
+    /* Check for implicit data regions: n_data <= region_number < 2*n_data */
+    else if (region_number < 2 * n_data) {
+        /* Calculate index into implicit_data_regions */
+        int idx = region_number - n_data;
         
         /* For implicit data region */
-        env->implicit_data_regions[idx].prefix = base;
-        env->implicit_data_regions[idx].mask = mask_or_bound;
-        qemu_log_mask(LOG_UNIMP, "HFI: Set implicit data region %d size: base=0x%016" PRIx64 
+        hc->implicit_data_regions.prefix[idx] = base;
+        hc->implicit_data_regions.mask[idx] = mask_or_bound;
+        riscv_hfi_update_cfg_id(hc);
+        env->hfi_tlb_ctx = -1;
+        riscv_hfi_flush_tlb(env);
+        qemu_log_mask(CPU_LOG_HFI, "HFI: Set implicit data region %d size: base=0x%016" PRIx64 
                      ", mask=0x%016" PRIx64 "\n", 
                      idx, base, mask_or_bound);
     } 
-    /* Check for implicit code regions: 2*HFI_NUM_DATA_REGIONS <= region_number < 2*HFI_NUM_DATA_REGIONS+HFI_NUM_CODE_REGIONS */
-    else if (region_number < 2 * HFI_NUM_DATA_REGIONS + HFI_NUM_CODE_REGIONS) {
-        /* Calculate index into implicit_code_regions array */
-        uint64_t idx = region_number - 2 * HFI_NUM_DATA_REGIONS;
+    /* Check for implicit code regions: 2*n_data <= region_number < 2*n_data+n_code */
+    else if (region_number < 2 * n_data + n_code) {
+        /* Calculate index into implicit_code_regions */
+        int idx = region_number - 2 * n_data;
         
         /* For implicit code region */
-        env->implicit_code_regions[idx].prefix = base;
-        env->implicit_code_regions[idx].mask = mask_or_bound;
-        qemu_log_mask(LOG_UNIMP, "HFI: Set implicit code region %d size: base=0x%016" PRIx64 
+        hc->implicit_code_regions.prefix[idx] = base;
+        hc->implicit_code_regions.mask[idx] = mask_or_bound;
+        riscv_hfi_update_cfg_id(hc);
+        qemu_log_mask(CPU_LOG_HFI, "HFI: Set implicit code region %d size: base=0x%016" PRIx64 
                      ", mask=0x%016" PRIx64 "\n", 
                      idx, base, mask_or_bound);
     } else {
-        qemu_log_mask(LOG_GUEST_ERROR, "HFI: Invalid region number %d\n", region_number);
+        qemu_log_mask(LOG_GUEST_ERROR, "HFI: Invalid region number %" PRIu64 "\n",
+                      region_number);
     }
 }
 
 void helper_hfi_set_region_permissions(CPURISCVState *env, uint64_t region_number, 
                                       uint64_t permission)
 {
-    /* Check for explicit data regions: 0 <= region_number < HFI_NUM_DATA_REGIONS */
-    if (region_number < HFI_NUM_DATA_REGIONS) {
+    uint64_t n_data = riscv_cpu_cfg(env)->hfi_data_regions;
+    uint64_t n_code = riscv_cpu_cfg(env)->hfi_code_regions;
+    HFIContext *hc = riscv_hfi_ctx(env);
+
+    /* Check for explicit data regions: 0 <= region_number < n_data */
+    if (region_number < n_data) {
+        HFIExplicitRegions *r = &hc->explicit_data_regions;
+        int idx = region_number;
+
         /* Extract permission bits for explicit data regions (R1) */
         bool enabled = (permission >> HFI_R1_ENABLED_BIT) & 0x1;
         bool read = (permission >> HFI_R1_READ_BIT) & 0x1;
         bool write = (permission >> HFI_R1_WRITE_BIT) & 0x1;
         bool is_large = (permission >> HFI_R1_IS_LARGE_BIT) & 0x1;
         
-        /* 
-         * TODO: Explicit data regions are not yet implemented.
-         */
-        qemu_log_mask(LOG_UNIMP, "HFI: Explicit data region %d permissions not yet implemented\n"
-                     "[en:%d, r:%d, w:%d, large:%d]\n",
-                     region_number, enabled, read, write, is_large);
+        /* Configure explicit data region */
+        r->perm_read = deposit32(r->perm_read, idx, 1, read);
+        r->perm_write = deposit32(r->perm_write, idx, 1, write);
+        r->is_large = deposit32(r->is_large, idx, 1, is_large);
+        r->enabled = deposit32(r->enabled, idx, 1, enabled);
+        riscv_hfi_update_cfg_id(hc);
+        qemu_log_mask(CPU_LOG_HFI, "HFI: Set permissions for explicit data region %d: "
+                     "en:%d, r:%d, w:%d, large:%d\n",
+                     idx, enabled, read, write, is_large);
     } 
-    /* Check for implicit data regions: HFI_NUM_DATA_REGIONS <= region_number < 2*HFI_NUM_DATA_REGIONS */
-    else if (region_number < 2 * HFI_NUM_DATA_REGIONS) {
+    /* Check for implicit data regions: n_data <= region_number < 2*n_data */
+    else if (region_number < 2 * n_data) {
+        HFIImplicitRegions *r = &hc->implicit_data_regions;
+
         /* Extract permission bits for implicit data regions (R2) */
         bool enabled = (permission >> HFI_R2_ENABLED_BIT) & 0x1;
         bool read = (permission >> HFI_R2_READ_BIT) & 0x1;
         bool write = (permission >> HFI_R2_WRITE_BIT) & 0x1;
         
-        /* Calculate index into implicit_data_regions array */
-        uint32_t idx = region_number - HFI_NUM_DATA_REGIONS;
+        /* Calculate index into implicit_data_regions */
+        int idx = region_number - n_data;
         
         /* Configure implicit data region */
-        env->implicit_data_regions[idx].perm_read = read;
-        env->implicit_data_regions[idx].perm_write = write;
-        env->implicit_data_regions[idx].enabled = enabled;
-        qemu_log_mask(LOG_UNIMP, "HFI: Set permissions for implicit data region %d: "
+        r->perm_read = deposit32(r->perm_read, idx, 1, read);
+        r->perm_write = deposit32(r->perm_write, idx, 1, write);
+        r->enabled = deposit32(r->enabled, idx, 1, enabled);
+        riscv_hfi_update_cfg_id(hc);
+        env->hfi_tlb_ctx = -1;
+        riscv_hfi_flush_tlb(env);
+        qemu_log_mask(CPU_LOG_HFI, "HFI: Set permissions for implicit data region %d: "
                      "en:%d, r:%d, w:%d\n",
                      idx, enabled, read, write);
     } 
-    /* Check for implicit code regions: 2*HFI_NUM_DATA_REGIONS <= region_number < 2*HFI_NUM_DATA_REGIONS+HFI_NUM_CODE_REGIONS */
-    else if (region_number < 2 * HFI_NUM_DATA_REGIONS + HFI_NUM_CODE_REGIONS) {
+    /* Check for implicit code regions: 2*n_data <= region_number < 2*n_data+n_code */
+    else if (region_number < 2 * n_data + n_code) {
+        HFIImplicitRegions *r = &hc->implicit_code_regions;
+
         /* Extract permission bits for implicit code regions (R3) */
         bool enabled = (permission >> HFI_R3_ENABLED_BIT) & 0x1;
         bool exec = (permission >> HFI_R3_EXEC_BIT) & 0x1;
         
-        /* Calculate index into implicit_code_regions array */
-        uint64_t idx = region_number - 2 * HFI_NUM_DATA_REGIONS;
+        /* Calculate index into implicit_code_regions */
+        int idx = region_number - 2 * n_data;
         
         /* Configure implicit code region */
-        env->implicit_code_regions[idx].perm_exec = exec;
-        env->implicit_code_regions[idx].enabled = enabled;
-        qemu_log_mask(LOG_UNIMP, "HFI: Set permissions for implicit code region %d: "
+        r->perm_exec = deposit32(r->perm_exec, idx, 1, exec);
+        r->enabled = deposit32(r->enabled, idx, 1, enabled);
+        riscv_hfi_update_cfg_id(hc);
+        qemu_log_mask(CPU_LOG_HFI, "HFI: Set permissions for implicit code region %d: "
                      "en:%d, x:%d\n",
                      idx, enabled, exec);
     } else {
-        qemu_log_mask(LOG_GUEST_ERROR, "HFI: Invalid region number %d\n", region_number);
+        qemu_log_mask(LOG_GUEST_ERROR, "HFI: Invalid region number %" PRIu64 "\n",
+                      region_number);
     }
 }
 
 void helper_hfi_print(CPURISCVState *env) {
-    qemu_log_mask(LOG_UNIMP, "HFI: print, region_type=%llu, exit_handler=0x%016" PRIx64 "\n", 
+    qemu_log_mask(CPU_LOG_HFI, "HFI: print, region_type=%llu, exit_handler=0x%016" PRIx64 "\n", 
         env->hfi_region_type,  env->hfi_exit_pc);
 }
\ No newline at end of file
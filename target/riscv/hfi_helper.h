@@ -2,33 +2,124 @@
 #define RISCV_HFI_HELPER_H
 
 #include "qemu/osdep.h"
+#include "qemu/units.h"
 #include "cpu.h"
 
+/*
+ * Explicit data regions are base+bound.  Small regions have byte granular
+ * bounds of up to 4GiB; large regions (R1 is_large) have any size, but
+ * their base and bound are only kept at 64KiB granularity.
+ */
+#define HFI_SMALL_REGION_MAX_BOUND  (4 * GiB)
+#define HFI_LARGE_REGION_ALIGN      (64 * KiB)
+
+static inline uint64_t hfi_explicit_base(const HFIExplicitRegions *r, int i)
+{
+    return r->is_large & BIT(i) ? r->base[i] & ~(HFI_LARGE_REGION_ALIGN - 1)
+                                : r->base[i];
+}
+
+static inline uint64_t hfi_explicit_bound(const HFIExplicitRegions *r, int i)
+{
+    return r->is_large & BIT(i) ? r->bound[i] & ~(HFI_LARGE_REGION_ALIGN - 1)
+                                : MIN(r->bound[i], HFI_SMALL_REGION_MAX_BOUND);
+}
+
+/* True if [start, last] lies inside implicit region i. */
+static inline bool hfi_implicit_match(const HFIImplicitRegions *r, int i,
+                                      uint64_t start, uint64_t last)
+{
+    return (start & r->mask[i]) == r->prefix[i] &&
+           (last & r->mask[i]) == r->prefix[i];
+}
+
+/*
+ * True if loads and stores are currently restricted to the implicit data
+ * regions.  Under softmmu this is enforced when filling the TLB.
+ */
+static inline bool riscv_hfi_data_checks_enabled(CPURISCVState *env)
+{
+    return env->hfi_status == 1 &&
+           env->hfi_region_type == HFI_REGION_TYPE_IMPLICIT;
+}
+
+/* The region context selected by hfi_context / hfi_enter. */
+static inline HFIContext *riscv_hfi_ctx(CPURISCVState *env)
+{
+    return &env->hfi_ctx[env->hfi_cur_ctx];
+}
+
+/*
+ * Drop TLB entries filled with permissions wider than the active implicit
+ * data regions allow.  Needed whenever the regions become more restrictive:
+ * on entering a sandbox and on changing a region from within one.
+ */
+void riscv_hfi_flush_tlb(CPURISCVState *env);
+
+/* Set up the region table registry, from riscv_translate_init(). */
+void riscv_hfi_init(void);
+
+/*
+ * Recompute hc->cfg_id after any change to the region table.
+ * The id is part of the TB key while a sandbox is active, which lets
+ * the translator emit the region checks with constant prefixes/masks:
+ * a different table has a different id, so it misses in the TB lookup
+ * and retranslates.
+ */
+void riscv_hfi_update_cfg_id(HFIContext *hc);
+
+/* Put hc in its reset state: every region disabled and don't-care masks. */
+void riscv_hfi_reset_ctx(HFIContext *hc);
+
+/*
+ * Whether hc, apart from its cfg_id, is in its reset state.  Unlike
+ * riscv_hfi_reset_ctx(), this leaves the region table registry alone.
+ */
+bool riscv_hfi_ctx_is_reset(const HFIContext *hc);
+
+#ifndef CONFIG_USER_ONLY
+/* Register the HFI statistics with query-stats, see monitor.c. */
+void riscv_hfi_register_stats(void);
+#endif
+
 void helper_hfi_log(CPURISCVState *env, uint64_t addr, uint64_t prefix, uint64_t mask,
     uint64_t region, uint64_t matched, uint64_t region_type);
 
 void helper_hfi_trap_log(CPURISCVState *env, uint64_t access_type, uint64_t region_type);
 
-/* 
- * This function takes one 64-bit argument representing the exit handler.
- * The region_type parameter specifies the type of region to use:
- *   0 = no sandboxing
- *   1 = explicit regions
- *   2 = implicit regions
- *   (other values reserved for future use)
+/*
+ * Raise the fault for a TB whose only insn lies outside of every
+ * executable code region.
+ */
+G_NORETURN void helper_hfi_code_fault(CPURISCVState *env);
+
+/*
+ * A TB of several insns leaves the code regions: restart it with the
+ * given cflags (one insn per TB) so the fault is raised precisely.
+ */
+G_NORETURN void helper_hfi_code_recheck(CPURISCVState *env, uint32_t cflags);
+
+/*
+ * Raise the access fault for a data access denied by the regions: a
+ * region-relative load/store (hfi_load, hfi_store) outside of the bound
+ * of its explicit data region, or for region < 0 an access that matches
+ * no implicit data region.
  */
-void helper_hfi_enter(CPURISCVState *env, uint64_t region_type, uint64_t exit_handler);
+G_NORETURN void helper_hfi_data_fault(CPURISCVState *env, uint32_t exception,
+                                      int32_t region);
 
 /*
- * Exits the HFI sandbox by resetting the HFI status.
+ * hfi_enter and hfi_exit are generated inline, see trans_hfi.c.inc.
+ * These are only called from there, for TLB maintenance and logging.
  */
-void helper_hfi_exit(CPURISCVState *env);
+void helper_hfi_flush_tlb(CPURISCVState *env);
+void helper_hfi_log_transition(CPURISCVState *env);
 
 /*
  * Set HFI region size for a specific region number
  * region_number: specifies which region to configure
- * base: base address of the region
- * mask_or_bound: size mask or bound of the region
+ * base: base address (explicit) or prefix (implicit) of the region
+ * mask_or_bound: bound (explicit) or lsb mask (implicit) of the region
  */
 void helper_hfi_set_region_size(CPURISCVState *env, uint64_t region_number, uint64_t base, uint64_t mask_or_bound);
 
@@ -23,6 +23,7 @@
 #include "migration/cpu.h"
 #include "system/cpu-timers.h"
 #include "debug.h"
+#include "hfi_helper.h"
 
 static bool pmp_needed(void *opaque)
 {
@@ -256,6 +257,7 @@ static int riscv_cpu_post_load(void *opaque, int version_id)
     CPURISCVState *env = &cpu->env;
 
     env->xl = cpu_recompute_xl(env);
+    riscv_pwc_flush(env);
     return 0;
 }
 
@@ -399,6 +401,112 @@ static const VMStateDescription vmstate_ssp = {
     }
 };
 
+static bool hfi_needed(void *opaque)
+{
+    RISCVCPU *cpu = opaque;
+    CPURISCVState *env = &cpu->env;
+
+    if (env->hfi_status || env->hfi_exit_pc || env->hfi_region_type ||
+        env->hfi_cur_ctx) {
+        return true;
+    }
+
+    /* Region tables that were never written need not be sent. */
+    for (int c = 0; c < HFI_MAX_CONTEXTS; c++) {
+        if (!riscv_hfi_ctx_is_reset(&env->hfi_ctx[c])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int hfi_post_load(void *opaque, int version_id)
+{
+    RISCVCPU *cpu = opaque;
+    CPURISCVState *env = &cpu->env;
+
+    if (env->hfi_cur_ctx >= cpu->cfg.hfi_contexts) {
+        error_report("HFI context %u out of range (hfi-contexts=%u)",
+                     env->hfi_cur_ctx, cpu->cfg.hfi_contexts);
+        return -EINVAL;
+    }
+
+    /* The ids are not sent: they key TBs of this QEMU only. */
+    for (int c = 0; c < HFI_MAX_CONTEXTS; c++) {
+        riscv_hfi_update_cfg_id(&env->hfi_ctx[c]);
+    }
+
+    /*
+     * cpu_common_post_load() flushes the TLB, so no entry is narrowed to
+     * any context yet.
+     */
+    env->hfi_tlb_ctx = -1;
+
+    return 0;
+}
+
+static const VMStateDescription vmstate_hfi_explicit_regions = {
+    .name = "cpu/hfi/explicit_regions",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64_ARRAY(base, HFIExplicitRegions, HFI_MAX_REGIONS),
+        VMSTATE_UINT64_ARRAY(bound, HFIExplicitRegions, HFI_MAX_REGIONS),
+        VMSTATE_UINT16(enabled, HFIExplicitRegions),
+        VMSTATE_UINT16(perm_read, HFIExplicitRegions),
+        VMSTATE_UINT16(perm_write, HFIExplicitRegions),
+        VMSTATE_UINT16(is_large, HFIExplicitRegions),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_hfi_implicit_regions = {
+    .name = "cpu/hfi/implicit_regions",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64_ARRAY(prefix, HFIImplicitRegions, HFI_MAX_REGIONS),
+        VMSTATE_UINT64_ARRAY(mask, HFIImplicitRegions, HFI_MAX_REGIONS),
+        VMSTATE_UINT16(enabled, HFIImplicitRegions),
+        VMSTATE_UINT16(perm_read, HFIImplicitRegions),
+        VMSTATE_UINT16(perm_write, HFIImplicitRegions),
+        VMSTATE_UINT16(perm_exec, HFIImplicitRegions),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_hfi_ctx = {
+    .name = "cpu/hfi/ctx",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .fields = (const VMStateField[]) {
+        VMSTATE_STRUCT(explicit_data_regions, HFIContext, 0,
+                       vmstate_hfi_explicit_regions, HFIExplicitRegions),
+        VMSTATE_STRUCT(implicit_data_regions, HFIContext, 0,
+                       vmstate_hfi_implicit_regions, HFIImplicitRegions),
+        VMSTATE_STRUCT(implicit_code_regions, HFIContext, 0,
+                       vmstate_hfi_implicit_regions, HFIImplicitRegions),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
+static const VMStateDescription vmstate_hfi = {
+    .name = "cpu/hfi",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = hfi_needed,
+    .post_load = hfi_post_load,
+    .fields = (const VMStateField[]) {
+        VMSTATE_UINT64(env.hfi_status, RISCVCPU),
+        VMSTATE_UINT64(env.hfi_exit_pc, RISCVCPU),
+        VMSTATE_UINT64(env.hfi_region_type, RISCVCPU),
+        VMSTATE_UINT32(env.hfi_cur_ctx, RISCVCPU),
+        VMSTATE_STRUCT_ARRAY(env.hfi_ctx, RISCVCPU, HFI_MAX_CONTEXTS, 0,
+                             vmstate_hfi_ctx, HFIContext),
+        VMSTATE_END_OF_LIST()
+    }
+};
+
 const VMStateDescription vmstate_riscv_cpu = {
     .name = "cpu",
     .version_id = 10,
@@ -475,6 +583,7 @@ const VMStateDescription vmstate_riscv_cpu = {
         &vmstate_elp,
         &vmstate_ssp,
         &vmstate_ctr,
+        &vmstate_hfi,
         NULL
     }
 };
@@ -23,6 +23,8 @@
 #include "cpu_bits.h"
 #include "monitor/monitor.h"
 #include "monitor/hmp-target.h"
+#include "system/stats.h"
+#include "hfi_helper.h"
 
 #ifdef TARGET_RISCV64
 #define PTE_HEADER_FIELDS       "vaddr            paddr            "\
@@ -236,3 +238,191 @@ void hmp_info_mem(Monitor *mon, const QDict *qdict)
 
     mem_info_svxx(mon, env);
 }
+
+/*
+ * HFI statistics.  Per-region counts are lists with one entry per
+ * explicit data region, of length hfi-data-regions.
+ */
+typedef struct HFIStatDesc {
+    const char *name;
+    size_t offset;       /* in HFIStats */
+    bool per_region;
+} HFIStatDesc;
+
+static const HFIStatDesc hfi_stat_descs[] = {
+    { "enter", offsetof(HFIStats, enter) },
+    { "exit", offsetof(HFIStats, exit) },
+    { "code-faults", offsetof(HFIStats, code_faults) },
+    { "implicit-data-read-faults",
+      offsetof(HFIStats, implicit_data_faults[0]) },
+    { "implicit-data-write-faults",
+      offsetof(HFIStats, implicit_data_faults[1]) },
+    { "explicit-data-read-faults",
+      offsetof(HFIStats, explicit_data_faults[0]), true },
+    { "explicit-data-write-faults",
+      offsetof(HFIStats, explicit_data_faults[1]), true },
+    { "sandbox-insns", offsetof(HFIStats, sandbox_insns) },
+};
+
+static StatsList *hfi_stats_add(StatsList *list, const char *name,
+                                const uint64_t *val, int n, bool is_list)
+{
+    Stats *stats = g_new0(Stats, 1);
+
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    if (is_list) {
+        uint64List *val_list = NULL;
+
+        for (int i = n - 1; i >= 0; i--) {
+            QAPI_LIST_PREPEND(val_list, val[i]);
+        }
+        stats->value->u.list = val_list;
+        stats->value->type = QTYPE_QLIST;
+    } else {
+        stats->value->u.scalar = *val;
+        stats->value->type = QTYPE_QNUM;
+    }
+
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static void hfi_query_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets, Error **errp)
+{
+    CPUState *cpu;
+
+    if (target != STATS_TARGET_VCPU) {
+        return;
+    }
+
+    /*
+     * The counters are only written by their vCPU, on slow paths, and
+     * are read here without stopping it.
+     */
+    CPU_FOREACH(cpu) {
+        CPURISCVState *env = cpu_env(cpu);
+        const uint8_t *base = (const uint8_t *)&env->hfi_stats;
+        int n_data = riscv_cpu_cfg(env)->hfi_data_regions;
+        StatsList *stats_list = NULL;
+
+        if (!apply_str_list_filter(cpu->parent_obj.canonical_path, targets)) {
+            continue;
+        }
+
+        for (int i = ARRAY_SIZE(hfi_stat_descs) - 1; i >= 0; i--) {
+            const HFIStatDesc *desc = &hfi_stat_descs[i];
+
+            if (apply_str_list_filter(desc->name, names)) {
+                stats_list = hfi_stats_add(stats_list, desc->name,
+                                           (const void *)(base + desc->offset),
+                                           n_data, desc->per_region);
+            }
+        }
+
+        if (stats_list) {
+            add_stats_entry(result, STATS_PROVIDER_HFI,
+                            cpu->parent_obj.canonical_path, stats_list);
+        }
+    }
+}
+
+static StatsSchemaValueList *hfi_stats_schema_add(StatsSchemaValueList *list,
+                                                  const char *name)
+{
+    StatsSchemaValueList *schema_entry = g_new0(StatsSchemaValueList, 1);
+
+    schema_entry->value = g_new0(StatsSchemaValue, 1);
+    schema_entry->value->type = STATS_TYPE_CUMULATIVE;
+    schema_entry->value->name = g_strdup(name);
+    schema_entry->next = list;
+
+    return schema_entry;
+}
+
+static void hfi_query_stats_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *stats_list = NULL;
+
+    for (int i = ARRAY_SIZE(hfi_stat_descs) - 1; i >= 0; i--) {
+        stats_list = hfi_stats_schema_add(stats_list, hfi_stat_descs[i].name);
+    }
+
+    add_stats_schema(result, STATS_PROVIDER_HFI, STATS_TARGET_VCPU,
+                     stats_list);
+}
+
+void riscv_hfi_register_stats(void)
+{
+    add_stats_callbacks(STATS_PROVIDER_HFI, hfi_query_stats_cb,
+                        hfi_query_stats_schemas_cb);
+}
+
+void hmp_info_hfi(Monitor *mon, const QDict *qdict)
+{
+    CPUArchState *env;
+    const HFIStats *stats;
+    const HFIExplicitRegions *er;
+    const HFIImplicitRegions *dr, *cr;
+    int n_data, n_code;
+
+    env = mon_get_cpu_env(mon);
+    if (!env) {
+        monitor_printf(mon, "No CPU available\n");
+        return;
+    }
+
+    stats = &env->hfi_stats;
+    er = &riscv_hfi_ctx(env)->explicit_data_regions;
+    dr = &riscv_hfi_ctx(env)->implicit_data_regions;
+    cr = &riscv_hfi_ctx(env)->implicit_code_regions;
+    n_data = riscv_cpu_cfg(env)->hfi_data_regions;
+    n_code = riscv_cpu_cfg(env)->hfi_code_regions;
+
+    monitor_printf(mon, "status %" PRIu64 " context %u region type %" PRIu64
+                   " exit handler 0x%016" PRIx64 "\n",
+                   env->hfi_status, env->hfi_cur_ctx, env->hfi_region_type,
+                   env->hfi_exit_pc);
+    monitor_printf(mon, "enter %" PRIu64 " exit %" PRIu64
+                   " sandbox insns %" PRIu64 "\n",
+                   stats->enter, stats->exit, stats->sandbox_insns);
+    monitor_printf(mon, "code faults %" PRIu64 " implicit data faults: read %"
+                   PRIu64 " write %" PRIu64 "\n", stats->code_faults,
+                   stats->implicit_data_faults[0],
+                   stats->implicit_data_faults[1]);
+
+    monitor_printf(mon, "\nexplicit data regions of context %u\n",
+                   env->hfi_cur_ctx);
+    for (int i = 0; i < n_data; i++) {
+        monitor_printf(mon, "%2d %c%c%c%c base 0x%016" PRIx64
+                       " bound 0x%016" PRIx64 " faults: read %" PRIu64
+                       " write %" PRIu64 "\n", i,
+                       er->enabled & BIT(i) ? 'e' : '-',
+                       er->perm_read & BIT(i) ? 'r' : '-',
+                       er->perm_write & BIT(i) ? 'w' : '-',
+                       er->is_large & BIT(i) ? 'L' : '-',
+                       er->base[i], er->bound[i],
+                       stats->explicit_data_faults[0][i],
+                       stats->explicit_data_faults[1][i]);
+    }
+
+    monitor_printf(mon, "\nimplicit data regions\n");
+    for (int i = 0; i < n_data; i++) {
+        monitor_printf(mon, "%2d %c%c%c prefix 0x%016" PRIx64
+                       " mask 0x%016" PRIx64 "\n", i,
+                       dr->enabled & BIT(i) ? 'e' : '-',
+                       dr->perm_read & BIT(i) ? 'r' : '-',
+                       dr->perm_write & BIT(i) ? 'w' : '-',
+                       dr->prefix[i], dr->mask[i]);
+    }
+
+    monitor_printf(mon, "\ncode regions\n");
+    for (int i = 0; i < n_code; i++) {
+        monitor_printf(mon, "%2d %c%c prefix 0x%016" PRIx64
+                       " mask 0x%016" PRIx64 "\n", i,
+                       cr->enabled & BIT(i) ? 'e' : '-',
+                       cr->perm_exec & BIT(i) ? 'x' : '-',
+                       cr->prefix[i], cr->mask[i]);
+    }
+}
@@ -21,9 +21,11 @@
 #include "qemu/osdep.h"
 #include "cpu.h"
 #include "internals.h"
+#include "pmu.h"
 #include "exec/exec-all.h"
 #include "exec/cputlb.h"
 #include "exec/cpu_ldst.h"
+#include "qemu/atomic128.h"
 #include "exec/helper-proto.h"
 #include "trace.h"
 
@@ -265,6 +267,107 @@ void helper_cbo_inval(CPURISCVState *env, target_ulong address)
     /* We don't emulate the cache-hierarchy, so we're done. */
 }
 
+static uint64_t amo_apply(uint32_t op, int bits, uint64_t old, uint64_t val)
+{
+    int64_t sold = sextract64(old, 0, bits);
+    int64_t sval = sextract64(val, 0, bits);
+    uint64_t uold = extract64(old, 0, bits);
+    uint64_t uval = extract64(val, 0, bits);
+
+    switch (op) {
+    case RISCV_AMO_SWAP:
+        return val;
+    case RISCV_AMO_ADD:
+        return old + val;
+    case RISCV_AMO_XOR:
+        return old ^ val;
+    case RISCV_AMO_AND:
+        return old & val;
+    case RISCV_AMO_OR:
+        return old | val;
+    case RISCV_AMO_MIN:
+        return sold < sval ? old : val;
+    case RISCV_AMO_MAX:
+        return sold > sval ? old : val;
+    case RISCV_AMO_MINU:
+        return uold < uval ? old : val;
+    case RISCV_AMO_MAXU:
+        return uold > uval ? old : val;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+/*
+ * A Zama16b AMO whose address is misaligned, but which stays within an
+ * aligned 16-byte block.  The TCG atomic helpers can only operate on
+ * naturally aligned data and would stop the world for it, so do the
+ * operation with a compare-and-swap loop on the aligned doubleword or
+ * quadword that contains the access.  Anything else, including MMIO
+ * and a containing block that is not accessible as a whole, still
+ * takes the exclusive path.
+ */
+target_ulong helper_amo_within16(CPURISCVState *env, target_ulong addr,
+                                 target_ulong val, uint32_t op, uint32_t oi)
+{
+    int mmu_idx = get_mmuidx(oi);
+    int size = memop_size(get_memop(oi));
+    int bits = size * 8;
+    int block = (addr & 7) + size <= 8 ? 8 : 16;
+    target_ulong base = addr & -block;
+    int shift = (addr - base) * 8;
+    uint64_t mask = MAKE_64BIT_MASK(0, bits);
+    uintptr_t ra = GETPC();
+    uint64_t old;
+    void *host;
+
+    if ((addr & 15) + size > 16) {
+        cpu_loop_exit_atomic(env_cpu(env), ra);
+    }
+
+    /* Raise any fault for the address of the access itself. */
+    probe_write(env, addr, size, mmu_idx, ra);
+    if (probe_access_flags(env, base, block, MMU_DATA_STORE, mmu_idx,
+                           true, &host, ra) & (TLB_INVALID_MASK | TLB_MMIO)) {
+        cpu_loop_exit_atomic(env_cpu(env), ra);
+    }
+
+    if (block == 8) {
+        MemOpIdx oi_ld = make_memop_idx(MO_LEUQ | MO_ATOM_NONE, mmu_idx);
+        MemOpIdx oi_cas = make_memop_idx(MO_LEUQ | MO_ALIGN, mmu_idx);
+        uint64_t cmp, new, mem = cpu_ldq_mmu(env, base, oi_ld, ra);
+
+        do {
+            cmp = mem;
+            old = (cmp >> shift) & mask;
+            new = amo_apply(op, bits, old, val) & mask;
+            new = (cmp & ~(mask << shift)) | (new << shift);
+            mem = cpu_atomic_cmpxchgq_le_mmu(env, base, cmp, new, oi_cas, ra);
+        } while (mem != cmp);
+    } else {
+#if HAVE_CMPXCHG128
+        MemOpIdx oi_ld = make_memop_idx(MO_LE | MO_128 | MO_ATOM_NONE,
+                                        mmu_idx);
+        MemOpIdx oi_cas = make_memop_idx(MO_LE | MO_128 | MO_ALIGN, mmu_idx);
+        Int128 field = int128_lshift(int128_make64(mask), shift);
+        Int128 cmp, new, mem = cpu_ld16_mmu(env, base, oi_ld, ra);
+
+        do {
+            cmp = mem;
+            old = int128_getlo(int128_urshift(cmp, shift)) & mask;
+            new = int128_make64(amo_apply(op, bits, old, val) & mask);
+            new = int128_or(int128_and(cmp, int128_not(field)),
+                            int128_lshift(new, shift));
+            mem = cpu_atomic_cmpxchgo_le_mmu(env, base, cmp, new, oi_cas, ra);
+        } while (!int128_eq(mem, cmp));
+#else
+        cpu_loop_exit_atomic(env_cpu(env), ra);
+#endif
+    }
+
+    return bits == 32 ? (target_ulong)(int32_t)old : old;
+}
+
 #ifndef CONFIG_USER_ONLY
 
 target_ulong helper_sret(CPURISCVState *env)
@@ -490,6 +593,23 @@ void helper_ctr_add_entry(CPURISCVState *env, target_ulong src,
                         env->priv, env->virt_enabled);
 }
 
+void helper_pmu_count_events(CPURISCVState *env, uint32_t loads,
+                             uint32_t stores, uint32_t branches)
+{
+    RISCVCPU *cpu = env_archcpu(env);
+
+    if (loads) {
+        riscv_pmu_add_ctr(cpu, RISCV_PMU_EVENT_CACHE_L1D_READ_ACCESS, loads);
+    }
+    if (stores) {
+        riscv_pmu_add_ctr(cpu, RISCV_PMU_EVENT_CACHE_L1D_WRITE_ACCESS, stores);
+    }
+    if (branches) {
+        riscv_pmu_add_ctr(cpu, RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS,
+                          branches);
+    }
+}
+
 void helper_ctr_clear(CPURISCVState *env)
 {
     /*
@@ -562,13 +682,27 @@ void helper_tlb_flush(CPURISCVState *env)
         riscv_raise_exception(env, RISCV_EXCP_VIRT_INSTRUCTION_FAULT, GETPC());
     } else {
         tlb_flush(cs);
+        riscv_pwc_flush(env);
     }
 }
 
+static void do_pwc_flush(CPUState *cs, run_on_cpu_data data)
+{
+    riscv_pwc_flush(cpu_env(cs));
+}
+
 void helper_tlb_flush_all(CPURISCVState *env)
 {
     CPUState *cs = env_cpu(env);
+    CPUState *other;
+
     tlb_flush_all_cpus_synced(cs);
+    CPU_FOREACH(other) {
+        if (other != cs) {
+            async_run_on_cpu(other, do_pwc_flush, RUN_ON_CPU_NULL);
+        }
+    }
+    riscv_pwc_flush(env);
 }
 
 void helper_hyp_tlb_flush(CPURISCVState *env)
@@ -582,6 +716,7 @@ void helper_hyp_tlb_flush(CPURISCVState *env)
     if (env->priv == PRV_M ||
         (env->priv == PRV_S && !env->virt_enabled)) {
         tlb_flush(cs);
+        riscv_pwc_flush(env);
         return;
     }
 
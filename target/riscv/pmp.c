@@ -30,6 +30,7 @@
 static bool pmp_write_cfg(CPURISCVState *env, uint32_t addr_index,
                           uint8_t val);
 static uint8_t pmp_read_cfg(CPURISCVState *env, uint32_t addr_index);
+static void pmp_update_index(CPURISCVState *env);
 
 /*
  * Accessor method to extract address matching type 'a field' from cfg reg
@@ -148,7 +149,9 @@ void pmp_unlock_entries(CPURISCVState *env)
 
     for (i = 0; i < pmp_num; i++) {
         env->pmp_state.pmp[i].cfg_reg &= ~(PMP_LOCK | PMP_AMATCH);
+        pmp_update_rule_addr(env, i);
     }
+    pmp_update_rule_nums(env);
 }
 
 static void pmp_decode_napot(hwaddr a, hwaddr *sa, hwaddr *ea)
@@ -225,6 +228,7 @@ void pmp_update_rule_nums(CPURISCVState *env)
             env->pmp_state.num_rules++;
         }
     }
+    pmp_update_index(env);
 }
 
 static int pmp_is_in_range(CPURISCVState *env, int pmp_index, hwaddr addr)
@@ -295,6 +299,182 @@ static bool pmp_hart_has_privs_default(CPURISCVState *env, pmp_priv_t privs,
 }
 
 
+/*
+ * Compute the privs that matching PMP rule @pmp_index grants to @mode.
+ */
+static pmp_priv_t pmp_rule_privs(CPURISCVState *env, int pmp_index,
+                                 target_ulong mode)
+{
+    uint8_t cfg = env->pmp_state.pmp[pmp_index].cfg_reg;
+    pmp_priv_t privs;
+
+    if (!MSECCFG_MML_ISSET(env)) {
+        /*
+         * If mseccfg.MML Bit is not set, do pmp priv check
+         * This will always apply to regular PMP.
+         */
+        privs = PMP_READ | PMP_WRITE | PMP_EXEC;
+        if ((mode != PRV_M) || pmp_is_locked(env, pmp_index)) {
+            privs &= cfg;
+        }
+        return privs;
+    }
+
+    /*
+     * If mseccfg.MML Bit set, do the enhanced pmp priv check.
+     * Convert the PMP permissions to match the truth table in the
+     * Smepmp spec.
+     */
+    const uint8_t smepmp_operation =
+        ((cfg & PMP_LOCK) >> 4) | ((cfg & PMP_READ) << 2) |
+        (cfg & PMP_WRITE) | ((cfg & PMP_EXEC) >> 2);
+
+    if (mode == PRV_M) {
+        switch (smepmp_operation) {
+        case 0:
+        case 1:
+        case 4:
+        case 5:
+        case 6:
+        case 7:
+        case 8:
+            return 0;
+        case 2:
+        case 3:
+        case 14:
+            return PMP_READ | PMP_WRITE;
+        case 9:
+        case 10:
+            return PMP_EXEC;
+        case 11:
+        case 13:
+            return PMP_READ | PMP_EXEC;
+        case 12:
+        case 15:
+            return PMP_READ;
+        default:
+            g_assert_not_reached();
+        }
+    } else {
+        switch (smepmp_operation) {
+        case 0:
+        case 8:
+        case 9:
+        case 12:
+        case 13:
+        case 14:
+            return 0;
+        case 1:
+        case 10:
+        case 11:
+            return PMP_EXEC;
+        case 2:
+        case 4:
+        case 15:
+            return PMP_READ;
+        case 3:
+        case 6:
+            return PMP_READ | PMP_WRITE;
+        case 5:
+            return PMP_READ | PMP_EXEC;
+        case 7:
+            return PMP_READ | PMP_WRITE | PMP_EXEC;
+        default:
+            g_assert_not_reached();
+        }
+    }
+}
+
+static int pmp_addr_cmp(const void *a, const void *b)
+{
+    hwaddr x = *(const hwaddr *)a;
+    hwaddr y = *(const hwaddr *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Rebuild the lookup index. The boundaries of all active rules cut the
+ * address space into segments that no rule partially overlaps, so every
+ * address in a segment matches the same highest priority rule. Adjacent
+ * segments matching the same rule are merged.
+ */
+static void pmp_update_index(CPURISCVState *env)
+{
+    pmp_table_t *t = &env->pmp_state;
+    hwaddr bound[2 * MAX_RISCV_PMPS];
+    hwaddr sa = 0, ea;
+    int nbound = 0;
+    int i, j, rule;
+
+    for (i = 0; i < MAX_RISCV_PMPS; i++) {
+        if (pmp_get_a_field(t->pmp[i].cfg_reg) != PMP_AMATCH_OFF) {
+            bound[nbound++] = t->addr[i].sa;
+            /* Wraps to 0 for a rule reaching the top, which is dropped */
+            bound[nbound++] = t->addr[i].ea + 1;
+        }
+    }
+    qsort(bound, nbound, sizeof(hwaddr), pmp_addr_cmp);
+
+    t->num_segs = 0;
+    t->last_seg = 0;
+    for (j = 0; j <= nbound; j++) {
+        if (j < nbound && bound[j] == sa) {
+            continue;
+        }
+        ea = j < nbound ? bound[j] - 1 : (hwaddr)-1;
+
+        rule = -1;
+        for (i = 0; i < MAX_RISCV_PMPS; i++) {
+            if (pmp_get_a_field(t->pmp[i].cfg_reg) != PMP_AMATCH_OFF &&
+                pmp_is_in_range(env, i, sa)) {
+                rule = i;
+                break;
+            }
+        }
+
+        if (t->num_segs && t->seg[t->num_segs - 1].rule == rule) {
+            t->seg[t->num_segs - 1].ea = ea;
+        } else {
+            pmp_seg_t *seg = &t->seg[t->num_segs++];
+
+            seg->sa = sa;
+            seg->ea = ea;
+            seg->rule = rule;
+            seg->privs[0] = rule < 0 ? 0 : pmp_rule_privs(env, rule, PRV_U);
+            seg->privs[1] = rule < 0 ? 0 : pmp_rule_privs(env, rule, PRV_M);
+        }
+        sa = ea + 1;
+    }
+}
+
+/*
+ * Find the segment containing @addr. The segments cover the whole address
+ * space, so this cannot fail once the index has been built.
+ */
+static const pmp_seg_t *pmp_find_seg(CPURISCVState *env, hwaddr addr)
+{
+    pmp_table_t *t = &env->pmp_state;
+    const pmp_seg_t *seg = &t->seg[t->last_seg];
+    uint32_t lo = 0, hi = t->num_segs - 1, mid;
+
+    if (addr >= seg->sa && addr <= seg->ea) {
+        return seg;
+    }
+
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (t->seg[mid].sa <= addr) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    t->last_seg = lo;
+    return &t->seg[lo];
+}
+
+
 /*
  * Public Interface
  */
@@ -312,6 +492,7 @@ bool pmp_hart_has_privs(CPURISCVState *env, hwaddr addr,
     int pmp_size = 0;
     hwaddr s = 0;
     hwaddr e = 0;
+    const pmp_seg_t *seg;
 
     /* Short cut if no rules */
     if (0 == pmp_get_num_rules(env)) {
@@ -332,6 +513,21 @@ bool pmp_hart_has_privs(CPURISCVState *env, hwaddr addr,
         pmp_size = size;
     }
 
+    /*
+     * An access that stays within one segment is either fully inside or
+     * fully outside of every rule, so the segment's rule is the one that
+     * the scan below would find.
+     */
+    seg = pmp_find_seg(env, addr);
+    if (addr + pmp_size - 1 >= addr && addr + pmp_size - 1 <= seg->ea) {
+        if (seg->rule < 0) {
+            return pmp_hart_has_privs_default(env, privs, allowed_privs,
+                                              mode);
+        }
+        *allowed_privs = seg->privs[mode == PRV_M];
+        return (privs & *allowed_privs) == privs;
+    }
+
     /*
      * 1.10 draft priv spec states there is an implicit order
      * from low to high
@@ -352,100 +548,12 @@ bool pmp_hart_has_privs(CPURISCVState *env, hwaddr addr,
         const uint8_t a_field =
             pmp_get_a_field(env->pmp_state.pmp[i].cfg_reg);
 
-        /*
-         * Convert the PMP permissions to match the truth table in the
-         * Smepmp spec.
-         */
-        const uint8_t smepmp_operation =
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_LOCK) >> 4) |
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_READ) << 2) |
-            (env->pmp_state.pmp[i].cfg_reg & PMP_WRITE) |
-            ((env->pmp_state.pmp[i].cfg_reg & PMP_EXEC) >> 2);
-
         if (((s + e) == 2) && (PMP_AMATCH_OFF != a_field)) {
             /*
              * If the PMP entry is not off and the address is in range,
              * do the priv check
              */
-            if (!MSECCFG_MML_ISSET(env)) {
-                /*
-                 * If mseccfg.MML Bit is not set, do pmp priv check
-                 * This will always apply to regular PMP.
-                 */
-                *allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
-                if ((mode != PRV_M) || pmp_is_locked(env, i)) {
-                    *allowed_privs &= env->pmp_state.pmp[i].cfg_reg;
-                }
-            } else {
-                /*
-                 * If mseccfg.MML Bit set, do the enhanced pmp priv check
-                 */
-                if (mode == PRV_M) {
-                    switch (smepmp_operation) {
-                    case 0:
-                    case 1:
-                    case 4:
-                    case 5:
-                    case 6:
-                    case 7:
-                    case 8:
-                        *allowed_privs = 0;
-                        break;
-                    case 2:
-                    case 3:
-                    case 14:
-                        *allowed_privs = PMP_READ | PMP_WRITE;
-                        break;
-                    case 9:
-                    case 10:
-                        *allowed_privs = PMP_EXEC;
-                        break;
-                    case 11:
-                    case 13:
-                        *allowed_privs = PMP_READ | PMP_EXEC;
-                        break;
-                    case 12:
-                    case 15:
-                        *allowed_privs = PMP_READ;
-                        break;
-                    default:
-                        g_assert_not_reached();
-                    }
-                } else {
-                    switch (smepmp_operation) {
-                    case 0:
-                    case 8:
-                    case 9:
-                    case 12:
-                    case 13:
-                    case 14:
-                        *allowed_privs = 0;
-                        break;
-                    case 1:
-                    case 10:
-                    case 11:
-                        *allowed_privs = PMP_EXEC;
-                        break;
-                    case 2:
-                    case 4:
-                    case 15:
-                        *allowed_privs = PMP_READ;
-                        break;
-                    case 3:
-                    case 6:
-                        *allowed_privs = PMP_READ | PMP_WRITE;
-                        break;
-                    case 5:
-                        *allowed_privs = PMP_READ | PMP_EXEC;
-                        break;
-                    case 7:
-                        *allowed_privs = PMP_READ | PMP_WRITE | PMP_EXEC;
-                        break;
-                    default:
-                        g_assert_not_reached();
-                    }
-                }
-            }
+            *allowed_privs = pmp_rule_privs(env, i, mode);
 
             /*
              * If matching address range was found, the protection bits
@@ -482,6 +590,7 @@ void pmpcfg_csr_write(CPURISCVState *env, uint32_t reg_index,
     if (modified) {
         pmp_update_rule_nums(env);
         tlb_flush(env_cpu(env));
+        riscv_pwc_flush(env);
     }
 }
 
@@ -538,7 +647,9 @@ void pmpaddr_csr_write(CPURISCVState *env, uint32_t addr_index,
                 if (is_next_cfg_tor) {
                     pmp_update_rule_addr(env, addr_index + 1);
                 }
+                pmp_update_index(env);
                 tlb_flush(env_cpu(env));
+                riscv_pwc_flush(env);
             }
         } else {
             qemu_log_mask(LOG_GUEST_ERROR,
@@ -600,6 +711,7 @@ void mseccfg_csr_write(CPURISCVState *env, target_ulong val)
         val |= (env->mseccfg & mask);
         if ((val ^ env->mseccfg) & mask) {
             tlb_flush(env_cpu(env));
+            riscv_pwc_flush(env);
         }
     } else {
         mask |= MSECCFG_RLB;
@@ -612,6 +724,7 @@ void mseccfg_csr_write(CPURISCVState *env, target_ulong val)
     }
 
     env->mseccfg = val;
+    pmp_update_index(env);
 }
 
 /*
@@ -638,11 +751,8 @@ target_ulong mseccfg_csr_read(CPURISCVState *env)
  */
 target_ulong pmp_get_tlb_size(CPURISCVState *env, hwaddr addr)
 {
-    hwaddr pmp_sa;
-    hwaddr pmp_ea;
     hwaddr tlb_sa = addr & ~(TARGET_PAGE_SIZE - 1);
     hwaddr tlb_ea = tlb_sa + TARGET_PAGE_SIZE - 1;
-    int i;
 
     /*
      * If PMP is not supported or there are no PMP rules, the TLB page will not
@@ -653,38 +763,19 @@ target_ulong pmp_get_tlb_size(CPURISCVState *env, hwaddr addr)
         return TARGET_PAGE_SIZE;
     }
 
-    for (i = 0; i < MAX_RISCV_PMPS; i++) {
-        if (pmp_get_a_field(env->pmp_state.pmp[i].cfg_reg) == PMP_AMATCH_OFF) {
-            continue;
-        }
-
-        pmp_sa = env->pmp_state.addr[i].sa;
-        pmp_ea = env->pmp_state.addr[i].ea;
-
-        /*
-         * Only the first PMP entry that covers (whole or partial of) the TLB
-         * page really matters:
-         * If it covers the whole TLB page, set the size to TARGET_PAGE_SIZE,
-         * since the following PMP entries have lower priority and will not
-         * affect the permissions of the page.
-         * If it only covers partial of the TLB page, set the size to 1 since
-         * the allowed permissions of the region may be different from other
-         * region of the page.
-         */
-        if (pmp_sa <= tlb_sa && pmp_ea >= tlb_ea) {
-            return TARGET_PAGE_SIZE;
-        } else if ((pmp_sa >= tlb_sa && pmp_sa <= tlb_ea) ||
-                   (pmp_ea >= tlb_sa && pmp_ea <= tlb_ea)) {
-            return 1;
-        }
-    }
-
     /*
-     * If no PMP entry matches the TLB page, the TLB page will also not be
-     * split into regions with different permissions by PMP so we set the size
-     * to TARGET_PAGE_SIZE.
+     * Only the first PMP entry that covers (whole or partial of) the TLB
+     * page really matters: if it covers the whole page, the following
+     * entries have lower priority and will not affect the permissions of
+     * the page. That is exactly the case where the whole page falls in a
+     * single segment of the lookup index, which is also true if no entry
+     * touches the page at all. Otherwise set the size to 1 since the
+     * allowed permissions may differ within the page.
      */
-    return TARGET_PAGE_SIZE;
+    if (pmp_find_seg(env, tlb_sa)->ea >= tlb_ea) {
+        return TARGET_PAGE_SIZE;
+    }
+    return 1;
 }
 
 /*
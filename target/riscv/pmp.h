@@ -59,10 +59,28 @@ typedef struct {
     hwaddr ea;
 } pmp_addr_t;
 
+/*
+ * The physical address space split at every rule boundary, with adjacent
+ * pieces that resolve to the same rule merged back together.
+ */
+#define MAX_RISCV_PMP_SEGS (2 * MAX_RISCV_PMPS + 1)
+
+typedef struct {
+    hwaddr sa;
+    hwaddr ea;
+    int8_t rule;        /* Highest priority matching rule, or -1 if none */
+    uint8_t privs[2];   /* Allowed privs for non-M and M-mode accesses */
+} pmp_seg_t;
+
 typedef struct {
     pmp_entry_t pmp[MAX_RISCV_PMPS];
     pmp_addr_t  addr[MAX_RISCV_PMPS];
     uint32_t num_rules;
+
+    /* Lookup index derived from the above, see pmp_update_index() */
+    pmp_seg_t seg[MAX_RISCV_PMP_SEGS];
+    uint32_t num_segs;
+    uint32_t last_seg;
 } pmp_table_t;
 
 void pmpcfg_csr_write(CPURISCVState *env, uint32_t reg_index,
@@ -36,7 +36,7 @@
  */
 void riscv_pmu_generate_fdt_node(void *fdt, uint32_t cmask, char *pmu_name)
 {
-    uint32_t fdt_event_ctr_map[15] = {};
+    uint32_t fdt_event_ctr_map[24] = {};
 
    /*
     * The event encoding is specified in the SBI specification
@@ -59,21 +59,36 @@ void riscv_pmu_generate_fdt_node(void *fdt, uint32_t cmask, char *pmu_name)
    fdt_event_ctr_map[4] = cpu_to_be32(0x00000002);
    fdt_event_ctr_map[5] = cpu_to_be32(cmask | 1 << 2);
 
-   /* SBI_PMU_HW_CACHE_DTLB : 0x03 READ : 0x00 MISS : 0x00 type(0x01) */
-   fdt_event_ctr_map[6] = cpu_to_be32(0x00010019);
-   fdt_event_ctr_map[7] = cpu_to_be32(0x00010019);
+   /* SBI_PMU_HW_BRANCH_INSTRUCTIONS: 0x05 : type(0x00) */
+   fdt_event_ctr_map[6] = cpu_to_be32(0x00000005);
+   fdt_event_ctr_map[7] = cpu_to_be32(0x00000005);
    fdt_event_ctr_map[8] = cpu_to_be32(cmask);
 
-   /* SBI_PMU_HW_CACHE_DTLB : 0x03 WRITE : 0x01 MISS : 0x00 type(0x01) */
-   fdt_event_ctr_map[9] = cpu_to_be32(0x0001001B);
-   fdt_event_ctr_map[10] = cpu_to_be32(0x0001001B);
+   /* SBI_PMU_HW_CACHE_L1D : 0x00 READ : 0x00 ACCESS : 0x00 type(0x01) */
+   fdt_event_ctr_map[9] = cpu_to_be32(0x00010000);
+   fdt_event_ctr_map[10] = cpu_to_be32(0x00010000);
    fdt_event_ctr_map[11] = cpu_to_be32(cmask);
 
-   /* SBI_PMU_HW_CACHE_ITLB : 0x04 READ : 0x00 MISS : 0x00 type(0x01) */
-   fdt_event_ctr_map[12] = cpu_to_be32(0x00010021);
-   fdt_event_ctr_map[13] = cpu_to_be32(0x00010021);
+   /* SBI_PMU_HW_CACHE_L1D : 0x00 WRITE : 0x01 ACCESS : 0x00 type(0x01) */
+   fdt_event_ctr_map[12] = cpu_to_be32(0x00010002);
+   fdt_event_ctr_map[13] = cpu_to_be32(0x00010002);
    fdt_event_ctr_map[14] = cpu_to_be32(cmask);
 
+   /* SBI_PMU_HW_CACHE_DTLB : 0x03 READ : 0x00 MISS : 0x00 type(0x01) */
+   fdt_event_ctr_map[15] = cpu_to_be32(0x00010019);
+   fdt_event_ctr_map[16] = cpu_to_be32(0x00010019);
+   fdt_event_ctr_map[17] = cpu_to_be32(cmask);
+
+   /* SBI_PMU_HW_CACHE_DTLB : 0x03 WRITE : 0x01 MISS : 0x00 type(0x01) */
+   fdt_event_ctr_map[18] = cpu_to_be32(0x0001001B);
+   fdt_event_ctr_map[19] = cpu_to_be32(0x0001001B);
+   fdt_event_ctr_map[20] = cpu_to_be32(cmask);
+
+   /* SBI_PMU_HW_CACHE_ITLB : 0x04 READ : 0x00 MISS : 0x00 type(0x01) */
+   fdt_event_ctr_map[21] = cpu_to_be32(0x00010021);
+   fdt_event_ctr_map[22] = cpu_to_be32(0x00010021);
+   fdt_event_ctr_map[23] = cpu_to_be32(cmask);
+
    /* This a OpenSBI specific DT property documented in OpenSBI docs */
    qemu_fdt_setprop(fdt, pmu_name, "riscv,event-to-mhpmcounters",
                     fdt_event_ctr_map, sizeof(fdt_event_ctr_map));
@@ -101,12 +116,13 @@ static bool riscv_pmu_counter_enabled(RISCVCPU *cpu, uint32_t ctr_idx)
     }
 }
 
-static int riscv_pmu_incr_ctr_rv32(RISCVCPU *cpu, uint32_t ctr_idx)
+static int riscv_pmu_incr_ctr_rv32(RISCVCPU *cpu, uint32_t ctr_idx,
+                                   int64_t n)
 {
     CPURISCVState *env = &cpu->env;
-    target_ulong max_val = UINT32_MAX;
     PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
     bool virt_on = env->virt_enabled;
+    uint64_t old_val, new_val;
 
     /* Privilege mode filtering */
     if ((env->priv == PRV_M &&
@@ -122,31 +138,30 @@ static int riscv_pmu_incr_ctr_rv32(RISCVCPU *cpu, uint32_t ctr_idx)
         return 0;
     }
 
+    old_val = deposit64((uint32_t)counter->mhpmcounter_val, 32, 32,
+                        counter->mhpmcounterh_val);
+    new_val = old_val + n;
+    counter->mhpmcounter_val = (uint32_t)new_val;
+    counter->mhpmcounterh_val = new_val >> 32;
+
     /* Handle the overflow scenario */
-    if (counter->mhpmcounter_val == max_val) {
-        if (counter->mhpmcounterh_val == max_val) {
-            counter->mhpmcounter_val = 0;
-            counter->mhpmcounterh_val = 0;
-            /* Generate interrupt only if OF bit is clear */
-            if (!(env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_OF)) {
-                env->mhpmeventh_val[ctr_idx] |= MHPMEVENTH_BIT_OF;
-                riscv_cpu_update_mip(env, MIP_LCOFIP, BOOL_TO_MASK(1));
-            }
-        } else {
-            counter->mhpmcounterh_val++;
+    if (n > 0 && new_val < old_val) {
+        /* Generate interrupt only if OF bit is clear */
+        if (!(env->mhpmeventh_val[ctr_idx] & MHPMEVENTH_BIT_OF)) {
+            env->mhpmeventh_val[ctr_idx] |= MHPMEVENTH_BIT_OF;
+            riscv_cpu_update_mip(env, MIP_LCOFIP, BOOL_TO_MASK(1));
         }
-    } else {
-        counter->mhpmcounter_val++;
     }
 
     return 0;
 }
 
-static int riscv_pmu_incr_ctr_rv64(RISCVCPU *cpu, uint32_t ctr_idx)
+static int riscv_pmu_incr_ctr_rv64(RISCVCPU *cpu, uint32_t ctr_idx,
+                                   int64_t n)
 {
     CPURISCVState *env = &cpu->env;
     PMUCTRState *counter = &env->pmu_ctrs[ctr_idx];
-    uint64_t max_val = UINT64_MAX;
+    uint64_t old_val = counter->mhpmcounter_val;
     bool virt_on = env->virt_enabled;
 
     /* Privilege mode filtering */
@@ -163,16 +178,15 @@ static int riscv_pmu_incr_ctr_rv64(RISCVCPU *cpu, uint32_t ctr_idx)
         return 0;
     }
 
+    counter->mhpmcounter_val = old_val + n;
+
     /* Handle the overflow scenario */
-    if (counter->mhpmcounter_val == max_val) {
-        counter->mhpmcounter_val = 0;
+    if (n > 0 && counter->mhpmcounter_val < old_val) {
         /* Generate interrupt only if OF bit is clear */
         if (!(env->mhpmevent_val[ctr_idx] & MHPMEVENT_BIT_OF)) {
             env->mhpmevent_val[ctr_idx] |= MHPMEVENT_BIT_OF;
             riscv_cpu_update_mip(env, MIP_LCOFIP, BOOL_TO_MASK(1));
         }
-    } else {
-        counter->mhpmcounter_val++;
     }
     return 0;
 }
@@ -273,6 +287,16 @@ void riscv_pmu_update_fixed_ctrs(CPURISCVState *env, target_ulong newpriv,
 }
 
 int riscv_pmu_incr_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx)
+{
+    return riscv_pmu_add_ctr(cpu, event_idx, 1);
+}
+
+/*
+ * Add @n events to the counter of @event_idx.  A negative @n takes back
+ * events that were counted ahead of time; that never signals an overflow.
+ */
+int riscv_pmu_add_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx,
+                      int64_t n)
 {
     uint32_t ctr_idx;
     int ret;
@@ -294,14 +318,34 @@ int riscv_pmu_incr_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx)
     }
 
     if (riscv_cpu_mxl(env) == MXL_RV32) {
-        ret = riscv_pmu_incr_ctr_rv32(cpu, ctr_idx);
+        ret = riscv_pmu_incr_ctr_rv32(cpu, ctr_idx, n);
     } else {
-        ret = riscv_pmu_incr_ctr_rv64(cpu, ctr_idx);
+        ret = riscv_pmu_incr_ctr_rv64(cpu, ctr_idx, n);
     }
 
     return ret;
 }
 
+void riscv_pmu_undo_tb_tail(RISCVCPU *cpu, uint32_t tail)
+{
+    uint32_t loads = FIELD_EX32(tail, PMU_TB_TAIL, LOADS);
+    uint32_t stores = FIELD_EX32(tail, PMU_TB_TAIL, STORES);
+    uint32_t branches = FIELD_EX32(tail, PMU_TB_TAIL, BRANCHES);
+
+    if (loads) {
+        riscv_pmu_add_ctr(cpu, RISCV_PMU_EVENT_CACHE_L1D_READ_ACCESS,
+                          -(int64_t)loads);
+    }
+    if (stores) {
+        riscv_pmu_add_ctr(cpu, RISCV_PMU_EVENT_CACHE_L1D_WRITE_ACCESS,
+                          -(int64_t)stores);
+    }
+    if (branches) {
+        riscv_pmu_add_ctr(cpu, RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS,
+                          -(int64_t)branches);
+    }
+}
+
 bool riscv_pmu_ctr_monitor_instructions(CPURISCVState *env,
                                         uint32_t target_ctr)
 {
@@ -394,6 +438,7 @@ int riscv_pmu_update_event_map(CPURISCVState *env, uint64_t value,
         g_hash_table_foreach_remove(cpu->pmu_event_ctr_map,
                                     pmu_remove_event_map,
                                     GUINT_TO_POINTER(ctr_idx));
+        riscv_pmu_update_tcg_events(env);
         return 0;
     }
 
@@ -406,6 +451,9 @@ int riscv_pmu_update_event_map(CPURISCVState *env, uint64_t value,
     switch (event_idx) {
     case RISCV_PMU_EVENT_HW_CPU_CYCLES:
     case RISCV_PMU_EVENT_HW_INSTRUCTIONS:
+    case RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS:
+    case RISCV_PMU_EVENT_CACHE_L1D_READ_ACCESS:
+    case RISCV_PMU_EVENT_CACHE_L1D_WRITE_ACCESS:
     case RISCV_PMU_EVENT_CACHE_DTLB_READ_MISS:
     case RISCV_PMU_EVENT_CACHE_DTLB_WRITE_MISS:
     case RISCV_PMU_EVENT_CACHE_ITLB_PREFETCH_MISS:
@@ -416,10 +464,45 @@ int riscv_pmu_update_event_map(CPURISCVState *env, uint64_t value,
     }
     g_hash_table_insert(cpu->pmu_event_ctr_map, GUINT_TO_POINTER(event_idx),
                         GUINT_TO_POINTER(ctr_idx));
+    riscv_pmu_update_tcg_events(env);
 
     return 0;
 }
 
+/*
+ * Work out which of the events counted by translated code currently feed
+ * an enabled counter. The result is part of the TB flags, so code is only
+ * instrumented for events that somebody is looking at. Callers are CSR
+ * writes, which end the TB, so no flush is needed for this to take effect.
+ */
+void riscv_pmu_update_tcg_events(CPURISCVState *env)
+{
+    static const struct {
+        enum riscv_pmu_event_idx event_idx;
+        uint32_t tcg_event;
+    } tcg_events[] = {
+        { RISCV_PMU_EVENT_CACHE_L1D_READ_ACCESS, RISCV_PMU_TCG_LOAD },
+        { RISCV_PMU_EVENT_CACHE_L1D_WRITE_ACCESS, RISCV_PMU_TCG_STORE },
+        { RISCV_PMU_EVENT_HW_BRANCH_INSTRUCTIONS, RISCV_PMU_TCG_BRANCH },
+    };
+    RISCVCPU *cpu = env_archcpu(env);
+    uint32_t ctr_idx;
+    int i;
+
+    cpu->pmu_tcg_events = 0;
+    if (!cpu->pmu_event_ctr_map) {
+        return;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(tcg_events); i++) {
+        ctr_idx = GPOINTER_TO_UINT(g_hash_table_lookup(cpu->pmu_event_ctr_map,
+                              GUINT_TO_POINTER(tcg_events[i].event_idx)));
+        if (riscv_pmu_counter_enabled(cpu, ctr_idx)) {
+            cpu->pmu_tcg_events |= tcg_events[i].tcg_event;
+        }
+    }
+}
+
 static bool pmu_hpmevent_is_of_set(CPURISCVState *env, uint32_t ctr_idx)
 {
     target_ulong mhpmevent_val;
@@ -31,6 +31,11 @@ void riscv_pmu_init(RISCVCPU *cpu, Error **errp);
 int riscv_pmu_update_event_map(CPURISCVState *env, uint64_t value,
                                uint32_t ctr_idx);
 int riscv_pmu_incr_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx);
+int riscv_pmu_add_ctr(RISCVCPU *cpu, enum riscv_pmu_event_idx event_idx,
+                      int64_t n);
+/* Take back the PMU_TB_TAIL events of an insn that did not complete. */
+void riscv_pmu_undo_tb_tail(RISCVCPU *cpu, uint32_t tail);
+void riscv_pmu_update_tcg_events(CPURISCVState *env);
 void riscv_pmu_generate_fdt_node(void *fdt, uint32_t cmask, char *pmu_name);
 int riscv_pmu_setup_timer(CPURISCVState *env, uint64_t value,
                           uint32_t ctr_idx);
@@ -129,8 +129,13 @@ static void riscv_restore_state_to_opc(CPUState *cs,
     } else {
         env->pc = pc;
     }
-    env->bins = data[1];
+    env->bins = (uint32_t)data[1];
     env->excp_uw2 = data[2];
+#ifndef CONFIG_USER_ONLY
+    if (data[1] >> 32) {
+        riscv_pmu_undo_tb_tail(cpu, data[1] >> 32);
+    }
+#endif
 }
 
 static const TCGCPUOps riscv_tcg_ops = {
@@ -1048,6 +1053,22 @@ static bool riscv_tcg_cpu_realize(CPUState *cs, Error **errp)
         return false;
     }
 
+    if (cpu->cfg.hfi_data_regions < 1 ||
+        cpu->cfg.hfi_data_regions > HFI_MAX_REGIONS ||
+        cpu->cfg.hfi_code_regions < 1 ||
+        cpu->cfg.hfi_code_regions > HFI_MAX_REGIONS) {
+        error_setg(errp, "hfi-data-regions and hfi-code-regions must be "
+                   "between 1 and %d", HFI_MAX_REGIONS);
+        return false;
+    }
+
+    if (cpu->cfg.hfi_contexts < 1 ||
+        cpu->cfg.hfi_contexts > HFI_MAX_CONTEXTS) {
+        error_setg(errp, "hfi-contexts must be between 1 and %d",
+                   HFI_MAX_CONTEXTS);
+        return false;
+    }
+
     if (mcc->misa_mxl_max >= MXL_RV128 && qemu_tcg_mttcg_enabled()) {
         /* Missing 128-bit aligned atomics */
         error_setg(errp,
@@ -30,6 +30,7 @@
 #include "semihosting/semihost.h"
 
 #include "internals.h"
+#include "hfi_helper.h"
 
 #define HELPER_H "helper.h"
 #include "exec/helper-info.c.inc"
@@ -119,6 +120,22 @@ typedef struct DisasContext {
     bool fcfi_lp_expected;
     /* zicfiss extension, if shadow stack was enabled during TB gen */
     bool bcfi_enabled;
+    /* HFI sandbox state, from TB_FLAGS2 */
+    bool hfi_enabled;
+    uint8_t hfi_region_type;
+    /* Region table the TB is specialised for, keyed by HFI_CFG_ID */
+    const HFIContext *hfi_ctx;
+    /* insn_start of the first insn, where TB-wide checks and counts go */
+    TCGOp *first_insn_start;
+    /* Smctr/Ssctr state, from TB_FLAGS2 */
+    RISCVCTRTBMode ctr_mode;
+    uint8_t ctr_depth;
+    uint16_t ctr_inh;
+    /* PMU events to count, from TB_FLAGS2, and the counts so far */
+    uint8_t pmu_events;
+    uint16_t pmu_loads;
+    uint16_t pmu_stores;
+    uint16_t pmu_branches;
 } DisasContext;
 
 static inline bool has_ext(DisasContext *ctx, uint32_t ext)
@@ -276,6 +293,37 @@ static void lookup_and_goto_ptr(DisasContext *ctx)
     tcg_gen_lookup_and_goto_ptr();
 }
 
+/*
+ * End the TB with an indirect jump to @dest, which is already in cpu_pc.
+ * Apart from FS, VS, VSTART_EQ_ZERO and the Zicfilp landing pad state,
+ * anything that changes the TB flags also ends the TB: CSR writes,
+ * vset{i}vl{i} and fault-only-first loads, which may shrink vl, all do.
+ * If none of those changed here, the next TB has the same flags as this
+ * one, and translator_goto_ptr() can probe the jump cache inline for it.
+ */
+static void gen_goto_ptr(DisasContext *ctx, TCGv dest)
+{
+    uint32_t tb_flags = ctx->base.tb->flags;
+    TCGv_i64 pc;
+
+    if (ctx->itrigger || ctx->fcfi_enabled ||
+        ctx->mstatus_fs != FIELD_EX32(tb_flags, TB_FLAGS, FS) ||
+        ctx->mstatus_vs != FIELD_EX32(tb_flags, TB_FLAGS, VS) ||
+        ctx->vstart_eq_zero !=
+            FIELD_EX32(tb_flags, TB_FLAGS, VSTART_EQ_ZERO)) {
+        lookup_and_goto_ptr(ctx);
+        return;
+    }
+
+    /* As computed by cpu_get_tb_cpu_state(). */
+    pc = tcg_temp_new_i64();
+    tcg_gen_extu_tl_i64(pc, dest);
+    if (get_xl(ctx) == MXL_RV32) {
+        tcg_gen_ext32u_i64(pc, pc);
+    }
+    translator_goto_ptr(&ctx->base, pc);
+}
+
 static void exit_tb(DisasContext *ctx)
 {
 #ifndef CONFIG_USER_ONLY
@@ -286,6 +334,28 @@ static void exit_tb(DisasContext *ctx)
     tcg_gen_exit_tb(NULL, 0);
 }
 
+/* Account one RISCV_PMU_TCG_* event, if it is being counted at all. */
+static void count_pmu_event(DisasContext *ctx, uint8_t event)
+{
+    if (!(ctx->pmu_events & event)) {
+        return;
+    }
+
+    switch (event) {
+    case RISCV_PMU_TCG_LOAD:
+        ctx->pmu_loads++;
+        break;
+    case RISCV_PMU_TCG_STORE:
+        ctx->pmu_stores++;
+        break;
+    case RISCV_PMU_TCG_BRANCH:
+        ctx->pmu_branches++;
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
 static void gen_goto_tb(DisasContext *ctx, int n, target_long diff)
 {
     target_ulong dest = ctx->base.pc_next + diff;
@@ -562,6 +632,59 @@ static void gen_set_fpr_d(DisasContext *ctx, int reg_num, TCGv_i64 t)
 }
 
 #ifndef CONFIG_USER_ONLY
+/*
+ * Record a control transfer within the current mode. The enable and
+ * filter state are part of the TB flags, see riscv_ctr_tb_flags(), so
+ * all that is left to do at run time is to append the entry to the ring.
+ */
+static void gen_ctr_add_entry(DisasContext *ctx, TCGv src, TCGv dst,
+                              CTRType type)
+{
+    uint32_t depth_mask = (16 << ctx->ctr_depth) - 1;
+    bool inh = ctx->ctr_inh & BIT(type);
+    TCGv_i32 status, head;
+    TCGv_ptr ptr;
+    TCGv_i64 t;
+
+    if (ctx->ctr_mode == CTR_TB_HELPER) {
+        gen_helper_ctr_add_entry(tcg_env, src, dst, tcg_constant_tl(type));
+        return;
+    }
+
+    /* Not taken branches have an enable bit rather than an inhibit bit. */
+    if (ctx->ctr_mode == CTR_TB_OFF ||
+        (type == CTRDATA_TYPE_NONTAKEN_BRANCH ? !inh : inh)) {
+        return;
+    }
+
+    status = tcg_temp_new_i32();
+    head = tcg_temp_new_i32();
+    ptr = tcg_temp_new_ptr();
+    t = tcg_temp_new_i64();
+
+    /* WRPTR is kept below the depth, so it is the low bits of sctrstatus. */
+    tcg_gen_ld_i32(status, tcg_env, offsetof(CPURISCVState, sctrstatus));
+    tcg_gen_andi_i32(head, status, depth_mask);
+    tcg_gen_shli_i32(head, head, 3);
+    tcg_gen_ext_i32_ptr(ptr, head);
+    tcg_gen_add_ptr(ptr, ptr, tcg_env);
+
+    tcg_gen_ext_tl_i64(t, src);
+    tcg_gen_ori_i64(t, t, CTRSOURCE_VALID);
+    tcg_gen_st_i64(t, ptr, offsetof(CPURISCVState, ctr_src));
+    tcg_gen_ext_tl_i64(t, dst);
+    tcg_gen_andi_i64(t, t, ~CTRTARGET_MISP);
+    tcg_gen_st_i64(t, ptr, offsetof(CPURISCVState, ctr_dst));
+    tcg_gen_st_i64(tcg_constant_i64(set_field(0, CTRDATA_TYPE_MASK, type)),
+                   ptr, offsetof(CPURISCVState, ctr_data));
+
+    tcg_gen_addi_i32(head, status, 1);
+    tcg_gen_andi_i32(head, head, depth_mask);
+    tcg_gen_andi_i32(status, status, ~SCTRSTATUS_WRPTR_MASK);
+    tcg_gen_or_i32(status, status, head);
+    tcg_gen_st_i32(status, tcg_env, offsetof(CPURISCVState, sctrstatus));
+}
+
 /*
  * Direct calls
  * - jal x1;
@@ -581,26 +704,39 @@ static void gen_ctr_jal(DisasContext *ctx, int rd, target_ulong imm)
 {
     TCGv dest = tcg_temp_new();
     TCGv src = tcg_temp_new();
-    TCGv type;
+    CTRType type;
 
     /*
      * If rd is x1 or x5 link registers, treat this as direct call otherwise
      * its a direct jump.
      */
     if (rd == 1 || rd == 5) {
-        type = tcg_constant_tl(CTRDATA_TYPE_DIRECT_CALL);
+        type = CTRDATA_TYPE_DIRECT_CALL;
     } else if (rd == 0) {
-        type = tcg_constant_tl(CTRDATA_TYPE_DIRECT_JUMP);
+        type = CTRDATA_TYPE_DIRECT_JUMP;
     } else {
-        type = tcg_constant_tl(CTRDATA_TYPE_OTHER_DIRECT_JUMP);
+        type = CTRDATA_TYPE_OTHER_DIRECT_JUMP;
     }
 
     gen_pc_plus_diff(dest, ctx, imm);
     gen_pc_plus_diff(src, ctx, 0);
-    gen_helper_ctr_add_entry(tcg_env, src, dest, type);
+    gen_ctr_add_entry(ctx, src, dest, type);
 }
 #endif
 
+/*
+ * Keep translating at the target of a direct jump, rather than ending the
+ * TB, when the target is ahead of the jump on the same page.  The TB then
+ * spans the skipped bytes as well, so that it is still invalidated by any
+ * write to the code it contains.  Backward jumps end the TB, so that a
+ * loop is not unrolled into it.
+ */
+static bool gen_jal_follow(DisasContext *ctx, target_long imm)
+{
+    return imm > 0 && !ctx->itrigger && !ctx->hfi_enabled &&
+           translator_is_same_page(&ctx->base, ctx->base.pc_next + imm);
+}
+
 static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
 {
     TCGv succ_pc = dest_gpr(ctx, rd);
@@ -618,14 +754,21 @@ static void gen_jal(DisasContext *ctx, int rd, target_ulong imm)
     }
 
 #ifndef CONFIG_USER_ONLY
-    if (ctx->cfg_ptr->ext_smctr || ctx->cfg_ptr->ext_ssctr) {
+    if (ctx->ctr_mode != CTR_TB_OFF) {
         gen_ctr_jal(ctx, rd, imm);
     }
 #endif
 
+    count_pmu_event(ctx, RISCV_PMU_TCG_BRANCH);
     gen_pc_plus_diff(succ_pc, ctx, ctx->cur_insn_len);
     gen_set_gpr(ctx, rd, succ_pc);
 
+    if (gen_jal_follow(ctx, imm)) {
+        /* riscv_tr_translate_insn() adds the length of this insn. */
+        ctx->base.pc_next += imm - ctx->cur_insn_len;
+        return;
+    }
+
     gen_goto_tb(ctx, 0, imm); /* must use this for safety */
     ctx->base.is_jmp = DISAS_NORETURN;
 }
@@ -1126,8 +1269,64 @@ static bool gen_unary_per_ol(DisasContext *ctx, arg_r2 *a, DisasExtend ext,
     return gen_unary(ctx, a, ext, f_tl);
 }
 
-static bool gen_amo(DisasContext *ctx, arg_atomic *a,
-                    void(*func)(TCGv, TCGv, TCGv, TCGArg, MemOp),
+typedef void (*gen_amo_fn)(TCGv, TCGv, TCGv, TCGArg, MemOp);
+
+static const struct {
+    gen_amo_fn func;
+    int op;
+} amo_within16_ops[] = {
+    { tcg_gen_atomic_xchg_tl,       RISCV_AMO_SWAP },
+    { tcg_gen_atomic_fetch_add_tl,  RISCV_AMO_ADD },
+    { tcg_gen_atomic_fetch_xor_tl,  RISCV_AMO_XOR },
+    { tcg_gen_atomic_fetch_and_tl,  RISCV_AMO_AND },
+    { tcg_gen_atomic_fetch_or_tl,   RISCV_AMO_OR },
+    { tcg_gen_atomic_fetch_smin_tl, RISCV_AMO_MIN },
+    { tcg_gen_atomic_fetch_smax_tl, RISCV_AMO_MAX },
+    { tcg_gen_atomic_fetch_umin_tl, RISCV_AMO_MINU },
+    { tcg_gen_atomic_fetch_umax_tl, RISCV_AMO_MAXU },
+};
+
+/*
+ * In a parallel TB, send misaligned Zama16b AMOs to a helper that does
+ * them with a compare-and-swap on the containing aligned block instead
+ * of stopping the world.  Aligned AMOs stay on the host atomic path.
+ */
+static bool gen_amo_within16(DisasContext *ctx, TCGv dest, TCGv addr,
+                             TCGv src, gen_amo_fn func, MemOp mop)
+{
+    TCGLabel *misaligned, *done;
+    TCGv t;
+
+    if (!(tb_cflags(ctx->base.tb) & CF_PARALLEL)) {
+        return false;
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(amo_within16_ops); i++) {
+        if (amo_within16_ops[i].func != func) {
+            continue;
+        }
+
+        misaligned = gen_new_label();
+        done = gen_new_label();
+        t = tcg_temp_new();
+
+        tcg_gen_andi_tl(t, addr, memop_size(mop) - 1);
+        tcg_gen_brcondi_tl(TCG_COND_NE, t, 0, misaligned);
+        func(dest, addr, src, ctx->mem_idx, mop);
+        tcg_gen_br(done);
+
+        gen_set_label(misaligned);
+        gen_helper_amo_within16(dest, tcg_env, addr, src,
+                                tcg_constant_i32(amo_within16_ops[i].op),
+                                tcg_constant_i32(make_memop_idx(mop,
+                                                 ctx->mem_idx)));
+        gen_set_label(done);
+        return true;
+    }
+    return false;
+}
+
+static bool gen_amo(DisasContext *ctx, arg_atomic *a, gen_amo_fn func,
                     MemOp mop)
 {
     TCGv dest = dest_gpr(ctx, a->rd);
@@ -1141,8 +1340,13 @@ static bool gen_amo(DisasContext *ctx, arg_atomic *a,
     }
 
     decode_save_opc(ctx, RISCV_UW2_ALWAYS_STORE_AMO);
+    count_pmu_event(ctx, RISCV_PMU_TCG_LOAD);
+    count_pmu_event(ctx, RISCV_PMU_TCG_STORE);
     src1 = get_address(ctx, a->rs1, 0);
-    func(dest, src1, src2, ctx->mem_idx, mop);
+    if ((mop & MO_ATOM_MASK) != MO_ATOM_WITHIN16 ||
+        !gen_amo_within16(ctx, dest, src1, src2, func, mop)) {
+        func(dest, src1, src2, ctx->mem_idx, mop);
+    }
 
     gen_set_gpr(ctx, a->rd, dest);
     return true;
@@ -1155,6 +1359,8 @@ static bool gen_cmpxchg(DisasContext *ctx, arg_atomic *a, MemOp mop)
     TCGv src2 = get_gpr(ctx, a->rs2, EXT_NONE);
 
     decode_save_opc(ctx, RISCV_UW2_ALWAYS_STORE_AMO);
+    count_pmu_event(ctx, RISCV_PMU_TCG_LOAD);
+    count_pmu_event(ctx, RISCV_PMU_TCG_STORE);
     tcg_gen_atomic_cmpxchg_tl(dest, src1, dest, src2, ctx->mem_idx, mop);
 
     gen_set_gpr(ctx, a->rd, dest);
@@ -1172,6 +1378,127 @@ static uint32_t opcode_at(DisasContextBase *dcbase, target_ulong pc)
 
 #define SS_MMU_INDEX(ctx) (ctx->mem_idx | MMU_IDX_SS_WRITE)
 
+/*
+ * HFI implicit regions are prefix/mask blocks, and the region table is
+ * part of the TB key (HFI_CFG_ID), so the checks are emitted with the
+ * regions as constants.  Regions sharing a mask are checked together:
+ * the masked address is looked up among their prefixes, sorted at
+ * translation time, with a binary search.  The cost of a check thus
+ * grows with the number of distinct masks, and only logarithmically with
+ * the number of regions.
+ */
+typedef struct HFIRegionKey {
+    target_ulong mask;
+    target_ulong prefix;
+} HFIRegionKey;
+
+static int hfi_region_key_cmp(const void *a, const void *b)
+{
+    const HFIRegionKey *ka = a, *kb = b;
+
+    if (ka->mask != kb->mask) {
+        return ka->mask < kb->mask ? -1 : 1;
+    }
+    if (ka->prefix != kb->prefix) {
+        return ka->prefix < kb->prefix ? -1 : 1;
+    }
+    return 0;
+}
+
+/*
+ * Log the address checked against each usable region.  This is a helper
+ * call per region, so it is only emitted into TBs translated while
+ * -d hfi is enabled.
+ */
+static void gen_hfi_log_regions(const HFIImplicitRegions *r, uint32_t usable,
+                                TCGv addr, int region_type)
+{
+    TCGv_i64 addr_i64 = tcg_temp_new_i64();
+
+    tcg_gen_extu_tl_i64(addr_i64, addr);
+    for (; usable; usable &= usable - 1) {
+        int i = ctz32(usable);
+
+        gen_helper_hfi_log(tcg_env, addr_i64, tcg_constant_i64(r->prefix[i]),
+                           tcg_constant_i64(r->mask[i]), tcg_constant_i64(i),
+                           tcg_constant_i64(0),
+                           tcg_constant_i64(region_type));
+    }
+}
+
+/* Branch to pass if val is one of the n sorted keys, else to miss. */
+static void gen_hfi_bsearch(TCGv val, const target_ulong *keys, int n,
+                            TCGLabel *pass, TCGLabel *miss)
+{
+    TCGLabel *upper;
+    int mid;
+
+    if (n <= 3) {
+        for (int i = 0; i < n; i++) {
+            tcg_gen_brcondi_tl(TCG_COND_EQ, val, keys[i], pass);
+        }
+        tcg_gen_br(miss);
+        return;
+    }
+
+    mid = n / 2;
+    upper = gen_new_label();
+    tcg_gen_brcondi_tl(TCG_COND_EQ, val, keys[mid], pass);
+    tcg_gen_brcondi_tl(TCG_COND_GTU, val, keys[mid], upper);
+    gen_hfi_bsearch(val, keys, mid, pass, miss);
+    gen_set_label(upper);
+    gen_hfi_bsearch(val, keys + mid + 1, n - mid - 1, pass, miss);
+}
+
+/*
+ * Branch to pass if [start, end] lies inside one of the regions of r
+ * selected by the usable bitmap; fall through otherwise.  end may be
+ * NULL to check a single address.
+ */
+static void gen_hfi_check_implicit(const HFIImplicitRegions *r,
+                                   uint32_t usable, TCGv start, TCGv end,
+                                   TCGLabel *pass)
+{
+    HFIRegionKey keys[HFI_MAX_REGIONS];
+    target_ulong prefixes[HFI_MAX_REGIONS];
+    TCGv ts = tcg_temp_new();
+    TCGv te = end ? tcg_temp_new() : NULL;
+    int n = 0;
+
+    for (; usable; usable &= usable - 1) {
+        int i = ctz32(usable);
+        target_ulong mask = r->mask[i];
+        target_ulong prefix = r->prefix[i];
+
+        /* A prefix with bits outside of the mask never matches. */
+        if (prefix & ~mask) {
+            continue;
+        }
+        keys[n].mask = mask;
+        keys[n].prefix = prefix;
+        n++;
+    }
+    qsort(keys, n, sizeof(keys[0]), hfi_region_key_cmp);
+
+    for (int g = 0; g < n;) {
+        target_ulong mask = keys[g].mask;
+        TCGLabel *miss = gen_new_label();
+        int k = 0;
+
+        for (; g < n && keys[g].mask == mask; g++) {
+            prefixes[k++] = keys[g].prefix;
+        }
+
+        tcg_gen_andi_tl(ts, start, mask);
+        if (end) {
+            tcg_gen_andi_tl(te, end, mask);
+            tcg_gen_brcond_tl(TCG_COND_NE, ts, te, miss);
+        }
+        gen_hfi_bsearch(ts, prefixes, k, pass, miss);
+        gen_set_label(miss);
+    }
+}
+
 /* Include insn module translation function */
 #include "insn_trans/trans_rvi.c.inc"
 #include "insn_trans/trans_rvm.c.inc"
@@ -1226,82 +1553,154 @@ const RISCVDecoder decoder_table[] = {
 
 const size_t decoder_table_size = ARRAY_SIZE(decoder_table);
 
-static void gen_hfi_check_current_pc(DisasContext *ctx) {
-    TCGLabel *skip = gen_new_label();
-    TCGLabel *pass = gen_new_label();
-
-    TCGv hfi_status = tcg_temp_new();
+/*
+ * The code regions are part of the TB key (HFI_CFG_ID), so the region
+ * table in env is the one the TB will run with and can be read at
+ * translation time.
+ */
+static bool hfi_code_range_ok(DisasContext *ctx, vaddr start, vaddr last)
+{
+    const HFIImplicitRegions *r = &ctx->hfi_ctx->implicit_code_regions;
 
-    tcg_gen_ld_tl(hfi_status, tcg_env, offsetof(CPURISCVState, hfi_status));
-    tcg_gen_brcondi_tl(TCG_COND_NE, hfi_status, 1, skip);
+    for (uint32_t m = r->enabled & r->perm_exec; m; m &= m - 1) {
+        if (hfi_implicit_match(r, ctz32(m), start, last)) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    TCGv pc = tcg_constant_tl(ctx->base.pc_next);
-    TCGv pc_end = tcg_constant_tl(ctx->base.pc_next + ctx->cur_insn_len - 1);
+/*
+ * Check the whole byte range of the TB, [pc_first, pc_next - 1], against
+ * the implicit code regions once, at TB entry.  Code regions are aligned
+ * prefix/mask blocks, so both ends lying in the same region implies that
+ * every insn in between does too.
+ *
+ * This is only needed for pcrel TBs, which may run at a virtual address
+ * other than the one they were translated at; otherwise each insn is
+ * checked at translation time by decode_opc.  It is emitted from tb_stop,
+ * once the extent of the TB is known, and inserted right after the first
+ * insn_start.  Only TBs translated inside a sandbox get it; the sandbox
+ * state is part of the TB key.
+ */
+static void gen_hfi_check_tb(DisasContext *ctx)
+{
+    const HFIImplicitRegions *r = &ctx->hfi_ctx->implicit_code_regions;
+    uint32_t usable = r->enabled & r->perm_exec;
+    TCGLabel *pass = gen_new_label();
+    TCGv end = tcg_temp_new();
 
-    for (int i = 0; i < HFI_NUM_CODE_REGIONS; i++) {
-        TCGLabel *next = gen_new_label();
+    tcg_ctx->emit_before_op = QTAILQ_NEXT(ctx->first_insn_start, link);
 
-        TCGv enabled = tcg_temp_new();
-        TCGv perm_exec = tcg_temp_new();
-        TCGv prefix = tcg_temp_new();
-        TCGv mask = tcg_temp_new();
+    tcg_gen_addi_tl(end, cpu_pc, ctx->base.pc_next - ctx->base.pc_first - 1);
 
-        tcg_gen_ld_tl(enabled, tcg_env, offsetof(CPURISCVState, implicit_code_regions[i].enabled));
-        tcg_gen_brcondi_tl(TCG_COND_EQ, enabled, 0, next);
+    if (qemu_loglevel_mask(CPU_LOG_HFI)) {
+        gen_hfi_log_regions(r, usable, cpu_pc, 2);
+    }
 
-        tcg_gen_ld_tl(perm_exec, tcg_env, offsetof(CPURISCVState, implicit_code_regions[i].perm_exec));
-        tcg_gen_brcondi_tl(TCG_COND_EQ, perm_exec, 0, next);
+    gen_hfi_check_implicit(r, usable, cpu_pc, end, pass);
 
-        tcg_gen_ld_tl(prefix, tcg_env, offsetof(CPURISCVState, implicit_code_regions[i].prefix));
-        tcg_gen_ld_tl(mask, tcg_env, offsetof(CPURISCVState, implicit_code_regions[i].mask));
+    /*
+     * Some insn leaves the code region.  If it can be one past the first,
+     * re-execute one insn per TB so that the fault is raised on exactly
+     * the first insn outside of the region.
+     */
+    if (ctx->base.num_insns > 1) {
+        uint32_t cflags = (tb_cflags(ctx->base.tb) & ~CF_COUNT_MASK) |
+                          CF_NOIRQ | 1;
+        gen_helper_hfi_code_recheck(tcg_env, tcg_constant_i32(cflags));
+    } else {
+        gen_helper_hfi_code_fault(tcg_env);
+    }
 
-        // Log current PC check
-        TCGv_i64 pc_i64 = tcg_temp_new_i64();
-        TCGv_i64 prefix_i64 = tcg_temp_new_i64();
-        TCGv_i64 mask_i64 = tcg_temp_new_i64();
-        TCGv_i64 region_i64 = tcg_constant_i64(i);
-        TCGv_i64 matched_i64 = tcg_constant_i64(0);  // before match
+    gen_set_label(pass);
+    tcg_ctx->emit_before_op = NULL;
+}
 
-        tcg_gen_extu_tl_i64(pc_i64, pc);
-        tcg_gen_extu_tl_i64(prefix_i64, prefix);
-        tcg_gen_extu_tl_i64(mask_i64, mask);
+/*
+ * Account the insns of a TB run inside the sandbox, at TB entry: one
+ * add per TB rather than per insn.  A TB left early by an exception is
+ * counted in full.  Inserted, like gen_hfi_check_tb, once the TB is
+ * complete.
+ */
+static void gen_hfi_count_insns(DisasContext *ctx)
+{
+    size_t offset = offsetof(CPURISCVState, hfi_stats.sandbox_insns);
+    TCGv_i64 t = tcg_temp_new_i64();
 
-        gen_helper_hfi_log(tcg_env, pc_i64, prefix_i64, mask_i64,
-                   region_i64, matched_i64, tcg_constant_i64(2));
+    tcg_ctx->emit_before_op = QTAILQ_NEXT(ctx->first_insn_start, link);
+    tcg_gen_ld_i64(t, tcg_env, offset);
+    tcg_gen_addi_i64(t, t, ctx->base.num_insns);
+    tcg_gen_st_i64(t, tcg_env, offset);
+    tcg_ctx->emit_before_op = NULL;
+}
 
-        // Perform masking and check
-        TCGv pc_masked = tcg_temp_new();
-        TCGv end_masked = tcg_temp_new();
+/* The PMU events counted so far in the TB, packed as PMU_TB_TAIL. */
+static uint32_t pmu_tb_events(DisasContext *ctx)
+{
+    uint32_t events = 0;
 
-        tcg_gen_and_tl(pc_masked, pc, mask);
-        tcg_gen_and_tl(end_masked, pc_end, mask);
+    events = FIELD_DP32(events, PMU_TB_TAIL, LOADS, ctx->pmu_loads);
+    events = FIELD_DP32(events, PMU_TB_TAIL, STORES, ctx->pmu_stores);
+    events = FIELD_DP32(events, PMU_TB_TAIL, BRANCHES, ctx->pmu_branches);
+    return events;
+}
 
-        tcg_gen_brcond_tl(TCG_COND_NE, pc_masked, prefix, next);
-        tcg_gen_brcond_tl(TCG_COND_EQ, end_masked, prefix, pass);
+/*
+ * Count the PMU events of the TB once, on entry. The counts are only known
+ * at the end of translation, so emit them after the first insn_start.
+ * Each insn_start carries the events of its insn and of the insns after
+ * it, which riscv_restore_state_to_opc() takes back if the insn does not
+ * complete.
+ */
+static void gen_pmu_count_events(DisasContext *ctx)
+{
+#ifndef CONFIG_USER_ONLY
+    uint64_t tail = 0;
+    TCGOp *op;
 
-        gen_set_label(next);
+    if (!ctx->pmu_loads && !ctx->pmu_stores && !ctx->pmu_branches) {
+        return;
     }
 
-    gen_helper_hfi_trap_log(tcg_env,
-        tcg_constant_i64(0),             // always read for PC fetch
-        tcg_constant_i64(2));            // region_type = 2 (internal code)
-    
-    gen_helper_raise_exception(tcg_env, tcg_constant_i32(RISCV_EXCP_LOAD_ACCESS_FAULT));
-
-    gen_set_label(pass);
-    gen_set_label(skip);
-}
+    /*
+     * riscv_tr_translate_insn() left the events of each insn alone in the
+     * high half of word 1.  No count exceeds its field, so the packed
+     * values can be summed as a whole.
+     */
+    QTAILQ_FOREACH_REVERSE(op, &tcg_ctx->ops, link) {
+        if (op->opc == INDEX_op_insn_start) {
+            uint64_t w = tcg_get_insn_start_param(op, 1);
 
+            tail += w >> 32;
+            tcg_set_insn_start_param(op, 1, (uint32_t)w | tail << 32);
+        }
+        if (op == ctx->first_insn_start) {
+            break;
+        }
+    }
 
+    tcg_ctx->emit_before_op = QTAILQ_NEXT(ctx->first_insn_start, link);
+    gen_helper_pmu_count_events(tcg_env, tcg_constant_i32(ctx->pmu_loads),
+                                tcg_constant_i32(ctx->pmu_stores),
+                                tcg_constant_i32(ctx->pmu_branches));
+    tcg_ctx->emit_before_op = NULL;
+#endif
+}
 
 static void decode_opc(CPURISCVState *env, DisasContext *ctx, uint16_t opcode)
 {
     ctx->virt_inst_excp = false;
     ctx->cur_insn_len = insn_len(opcode);
 
-    // check hfi code here
-    // if (env->hfi_status) // adding this check can cause problems with cached TBs
-    gen_hfi_check_current_pc(ctx);
+    if (ctx->hfi_enabled && !(tb_cflags(ctx->base.tb) & CF_PCREL) &&
+        !hfi_code_range_ok(ctx, ctx->base.pc_next,
+                           ctx->base.pc_next + ctx->cur_insn_len - 1)) {
+        /* The helper restores the pc of this insn from its insn_start. */
+        gen_helper_hfi_code_fault(tcg_env);
+        ctx->base.is_jmp = DISAS_NORETURN;
+        return;
+    }
 
     /* Check for compressed insn */
     if (ctx->cur_insn_len == 2) {
@@ -1378,6 +1777,19 @@ static void riscv_tr_init_disas_context(DisasContextBase *dcbase, CPUState *cs)
     ctx->zero = tcg_constant_tl(0);
     ctx->virt_inst_excp = false;
     ctx->decoders = cpu->decoders;
+    ctx->hfi_enabled = FIELD_EX64(ctx->base.tb->cs_base, TB_FLAGS2,
+                                  HFI_ENABLED);
+    ctx->hfi_region_type = FIELD_EX64(ctx->base.tb->cs_base, TB_FLAGS2,
+                                      HFI_REGION_TYPE);
+    ctx->hfi_ctx = riscv_hfi_ctx(env);
+    ctx->ctr_mode = FIELD_EX64(ctx->base.tb->cs_base, TB_FLAGS2, CTR_MODE);
+    ctx->ctr_depth = FIELD_EX64(ctx->base.tb->cs_base, TB_FLAGS2, CTR_DEPTH);
+    ctx->ctr_inh = FIELD_EX64(ctx->base.tb->cs_base, TB_FLAGS2, CTR_INH);
+    ctx->pmu_events = FIELD_EX64(ctx->base.tb->cs_base, TB_FLAGS2,
+                                 PMU_EVENTS);
+    ctx->pmu_loads = 0;
+    ctx->pmu_stores = 0;
+    ctx->pmu_branches = 0;
 }
 
 static void riscv_tr_tb_start(DisasContextBase *db, CPUState *cpu)
@@ -1402,11 +1814,26 @@ static void riscv_tr_translate_insn(DisasContextBase *dcbase, CPUState *cpu)
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
     CPURISCVState *env = cpu_env(cpu);
     uint16_t opcode16 = translator_lduw(env, &ctx->base, ctx->base.pc_next);
+    uint32_t pmu_events = pmu_tb_events(ctx);
+
+    if (ctx->base.num_insns == 1) {
+        ctx->first_insn_start = ctx->base.insn_start;
+    }
 
     ctx->ol = ctx->xl;
     decode_opc(env, ctx, opcode16);
     ctx->base.pc_next += ctx->cur_insn_len;
 
+    /* The events of this insn, see gen_pmu_count_events(). */
+    pmu_events = pmu_tb_events(ctx) - pmu_events;
+    if (pmu_events) {
+        TCGOp *op = ctx->base.insn_start;
+
+        tcg_set_insn_start_param(op, 1,
+                                 tcg_get_insn_start_param(op, 1) |
+                                 (uint64_t)pmu_events << 32);
+    }
+
     /*
      * If 'fcfi_lp_expected' is still true after processing the instruction,
      * then we did not see an 'lpad' instruction, and must raise an exception.
@@ -1449,6 +1876,17 @@ static void riscv_tr_tb_stop(DisasContextBase *dcbase, CPUState *cpu)
 {
     DisasContext *ctx = container_of(dcbase, DisasContext, base);
 
+    if (ctx->hfi_enabled) {
+        gen_hfi_count_insns(ctx);
+        if (tb_cflags(ctx->base.tb) & CF_PCREL) {
+            gen_hfi_check_tb(ctx);
+        }
+    }
+
+    if (ctx->pmu_events) {
+        gen_pmu_count_events(ctx);
+    }
+
     switch (ctx->base.is_jmp) {
     case DISAS_TOO_MANY:
         gen_goto_tb(ctx, 0, 0);
@@ -1508,4 +1946,6 @@ void riscv_translate_init(void)
                              "load_res");
     load_val = tcg_global_mem_new(tcg_env, offsetof(CPURISCVState, load_val),
                              "load_val");
+
+    riscv_hfi_init();
 }
@@ -245,72 +245,135 @@ static void vext_set_tail_elems_1s(target_ulong vl, void *vd,
     }
 }
 
+/*
+ * Strided and indexed accesses visit pages in any order, so instead of
+ * probing the whole access up front, remember the last page touched.
+ * It is probed once, as a whole and without faulting: if it is plain RAM
+ * every later segment inside it is accessed through the host address.
+ * Otherwise (MMIO, watchpoints, sub-page PMP, faults) the elements in it
+ * go through the softmmu, which raises any exception for the right
+ * element.
+ */
+typedef struct VextHostPage {
+    vaddr addr;
+    void *host;
+} VextHostPage;
+
+#define VEXT_HOST_PAGE_INIT { .addr = -1 }
+
+static inline QEMU_ALWAYS_INLINE void *
+vext_host_page(CPURISCVState *env, VextHostPage *page, vaddr addr,
+               uint32_t size, MMUAccessType access_type, int mmu_index,
+               uintptr_t ra)
+{
+    vaddr page_addr = addr & TARGET_PAGE_MASK;
+
+    if (((addr + size - 1) & TARGET_PAGE_MASK) != page_addr) {
+        return NULL;
+    }
+    if (page_addr != page->addr) {
+        void *host;
+        int flags = probe_access_flags(env, page_addr, TARGET_PAGE_SIZE,
+                                       access_type, mmu_index, true, &host,
+                                       ra);
+
+        page->addr = page_addr;
+        page->host = flags == 0 ? host : NULL;
+    }
+    return page->host ? page->host + (addr - page_addr) : NULL;
+}
+
+/* Access the nf fields of segment i at addr */
+static inline QEMU_ALWAYS_INLINE void
+vext_ldst_segment(CPURISCVState *env, void *vd, target_ulong addr,
+                  uint32_t i, uint32_t nf, uint32_t max_elems,
+                  uint32_t log2_esz, bool is_load, int mmu_index,
+                  VextHostPage *page, vext_ldst_elem_fn_tlb *ldst_tlb,
+                  vext_ldst_elem_fn_host *ldst_host, uintptr_t ra)
+{
+    MMUAccessType access_type = is_load ? MMU_DATA_LOAD : MMU_DATA_STORE;
+    void *host = vext_host_page(env, page, adjust_addr(env, addr),
+                                nf << log2_esz, access_type, mmu_index, ra);
+    uint32_t k;
+
+    for (k = 0; k < nf; k++) {
+        if (host) {
+            ldst_host(vd, i + k * max_elems, host + (k << log2_esz));
+        } else {
+            ldst_tlb(env, adjust_addr(env, addr + (k << log2_esz)),
+                     i + k * max_elems, vd, ra);
+        }
+    }
+}
+
 /*
  * stride: access vector element from strided memory
  */
-static void
+static inline QEMU_ALWAYS_INLINE void
 vext_ldst_stride(void *vd, void *v0, target_ulong base, target_ulong stride,
                  CPURISCVState *env, uint32_t desc, uint32_t vm,
-                 vext_ldst_elem_fn_tlb *ldst_elem, uint32_t log2_esz,
-                 uintptr_t ra)
+                 vext_ldst_elem_fn_tlb *ldst_tlb,
+                 vext_ldst_elem_fn_host *ldst_host, uint32_t log2_esz,
+                 uintptr_t ra, bool is_load)
 {
-    uint32_t i, k;
+    uint32_t i;
     uint32_t nf = vext_nf(desc);
     uint32_t max_elems = vext_max_elems(desc, log2_esz);
     uint32_t esz = 1 << log2_esz;
     uint32_t vma = vext_vma(desc);
+    int mmu_index = riscv_env_mmu_index(env, false);
+    VextHostPage page = VEXT_HOST_PAGE_INIT;
 
     VSTART_CHECK_EARLY_EXIT(env, env->vl);
 
     for (i = env->vstart; i < env->vl; env->vstart = ++i) {
-        k = 0;
-        while (k < nf) {
-            if (!vm && !vext_elem_mask(v0, i)) {
-                /* set masked-off elements to 1s */
+        if (!vm && !vext_elem_mask(v0, i)) {
+            /* set masked-off elements to 1s */
+            for (uint32_t k = 0; k < nf; k++) {
                 vext_set_elems_1s(vd, vma, (i + k * max_elems) * esz,
                                   (i + k * max_elems + 1) * esz);
-                k++;
-                continue;
             }
-            target_ulong addr = base + stride * i + (k << log2_esz);
-            ldst_elem(env, adjust_addr(env, addr), i + k * max_elems, vd, ra);
-            k++;
+            continue;
         }
+        vext_ldst_segment(env, vd, base + stride * i, i, nf, max_elems,
+                          log2_esz, is_load, mmu_index, &page,
+                          ldst_tlb, ldst_host, ra);
     }
     env->vstart = 0;
 
     vext_set_tail_elems_1s(env->vl, vd, desc, nf, esz, max_elems);
 }
 
-#define GEN_VEXT_LD_STRIDE(NAME, ETYPE, LOAD_FN)                        \
+#define GEN_VEXT_LD_STRIDE(NAME, ETYPE, LOAD_FN_TLB, LOAD_FN_HOST)      \
 void HELPER(NAME)(void *vd, void * v0, target_ulong base,               \
                   target_ulong stride, CPURISCVState *env,              \
                   uint32_t desc)                                        \
 {                                                                       \
     uint32_t vm = vext_vm(desc);                                        \
-    vext_ldst_stride(vd, v0, base, stride, env, desc, vm, LOAD_FN,      \
-                     ctzl(sizeof(ETYPE)), GETPC());                     \
+    vext_ldst_stride(vd, v0, base, stride, env, desc, vm, LOAD_FN_TLB,  \
+                     LOAD_FN_HOST, ctzl(sizeof(ETYPE)), GETPC(), true); \
 }
 
-GEN_VEXT_LD_STRIDE(vlse8_v,  int8_t,  lde_b_tlb)
-GEN_VEXT_LD_STRIDE(vlse16_v, int16_t, lde_h_tlb)
-GEN_VEXT_LD_STRIDE(vlse32_v, int32_t, lde_w_tlb)
-GEN_VEXT_LD_STRIDE(vlse64_v, int64_t, lde_d_tlb)
+GEN_VEXT_LD_STRIDE(vlse8_v,  int8_t,  lde_b_tlb, lde_b_host)
+GEN_VEXT_LD_STRIDE(vlse16_v, int16_t, lde_h_tlb, lde_h_host)
+GEN_VEXT_LD_STRIDE(vlse32_v, int32_t, lde_w_tlb, lde_w_host)
+GEN_VEXT_LD_STRIDE(vlse64_v, int64_t, lde_d_tlb, lde_d_host)
 
-#define GEN_VEXT_ST_STRIDE(NAME, ETYPE, STORE_FN)                       \
-void HELPER(NAME)(void *vd, void *v0, target_ulong base,                \
-                  target_ulong stride, CPURISCVState *env,              \
-                  uint32_t desc)                                        \
-{                                                                       \
-    uint32_t vm = vext_vm(desc);                                        \
-    vext_ldst_stride(vd, v0, base, stride, env, desc, vm, STORE_FN,     \
-                     ctzl(sizeof(ETYPE)), GETPC());                     \
+#define GEN_VEXT_ST_STRIDE(NAME, ETYPE, STORE_FN_TLB, STORE_FN_HOST)     \
+void HELPER(NAME)(void *vd, void *v0, target_ulong base,                 \
+                  target_ulong stride, CPURISCVState *env,               \
+                  uint32_t desc)                                         \
+{                                                                        \
+    uint32_t vm = vext_vm(desc);                                         \
+    vext_ldst_stride(vd, v0, base, stride, env, desc, vm, STORE_FN_TLB,  \
+                     STORE_FN_HOST, ctzl(sizeof(ETYPE)), GETPC(),        \
+                     false);                                             \
 }
 
-GEN_VEXT_ST_STRIDE(vsse8_v,  int8_t,  ste_b_tlb)
-GEN_VEXT_ST_STRIDE(vsse16_v, int16_t, ste_h_tlb)
-GEN_VEXT_ST_STRIDE(vsse32_v, int32_t, ste_w_tlb)
-GEN_VEXT_ST_STRIDE(vsse64_v, int64_t, ste_d_tlb)
+GEN_VEXT_ST_STRIDE(vsse8_v,  int8_t,  ste_b_tlb, ste_b_host)
+GEN_VEXT_ST_STRIDE(vsse16_v, int16_t, ste_h_tlb, ste_h_host)
+GEN_VEXT_ST_STRIDE(vsse32_v, int32_t, ste_w_tlb, ste_w_host)
+GEN_VEXT_ST_STRIDE(vsse64_v, int64_t, ste_d_tlb, ste_d_host)
 
 /*
  * unit-stride: access elements stored contiguously in memory
@@ -452,7 +515,8 @@ void HELPER(NAME##_mask)(void *vd, void *v0, target_ulong base,     \
 {                                                                   \
     uint32_t stride = vext_nf(desc) << ctzl(sizeof(ETYPE));         \
     vext_ldst_stride(vd, v0, base, stride, env, desc, false,        \
-                     LOAD_FN_TLB, ctzl(sizeof(ETYPE)), GETPC());    \
+                     LOAD_FN_TLB, LOAD_FN_HOST,                     \
+                     ctzl(sizeof(ETYPE)), GETPC(), true);           \
 }                                                                   \
                                                                     \
 void HELPER(NAME)(void *vd, void *v0, target_ulong base,            \
@@ -473,7 +537,8 @@ void HELPER(NAME##_mask)(void *vd, void *v0, target_ulong base,          \
 {                                                                        \
     uint32_t stride = vext_nf(desc) << ctzl(sizeof(ETYPE));              \
     vext_ldst_stride(vd, v0, base, stride, env, desc, false,             \
-                     STORE_FN_TLB, ctzl(sizeof(ETYPE)), GETPC());        \
+                     STORE_FN_TLB, STORE_FN_HOST, ctzl(sizeof(ETYPE)),   \
+                     GETPC(), false);                                    \
 }                                                                        \
                                                                          \
 void HELPER(NAME)(void *vd, void *v0, target_ulong base,                 \
@@ -527,93 +592,95 @@ GEN_VEXT_GET_INDEX_ADDR(idx_h, uint16_t, H2)
 GEN_VEXT_GET_INDEX_ADDR(idx_w, uint32_t, H4)
 GEN_VEXT_GET_INDEX_ADDR(idx_d, uint64_t, H8)
 
-static inline void
+static inline QEMU_ALWAYS_INLINE void
 vext_ldst_index(void *vd, void *v0, target_ulong base,
                 void *vs2, CPURISCVState *env, uint32_t desc,
                 vext_get_index_addr get_index_addr,
-                vext_ldst_elem_fn_tlb *ldst_elem,
-                uint32_t log2_esz, uintptr_t ra)
+                vext_ldst_elem_fn_tlb *ldst_tlb,
+                vext_ldst_elem_fn_host *ldst_host,
+                uint32_t log2_esz, uintptr_t ra, bool is_load)
 {
-    uint32_t i, k;
+    uint32_t i;
     uint32_t nf = vext_nf(desc);
     uint32_t vm = vext_vm(desc);
     uint32_t max_elems = vext_max_elems(desc, log2_esz);
     uint32_t esz = 1 << log2_esz;
     uint32_t vma = vext_vma(desc);
+    int mmu_index = riscv_env_mmu_index(env, false);
+    VextHostPage page = VEXT_HOST_PAGE_INIT;
 
     VSTART_CHECK_EARLY_EXIT(env, env->vl);
 
     /* load bytes from guest memory */
     for (i = env->vstart; i < env->vl; env->vstart = ++i) {
-        k = 0;
-        while (k < nf) {
-            if (!vm && !vext_elem_mask(v0, i)) {
-                /* set masked-off elements to 1s */
+        if (!vm && !vext_elem_mask(v0, i)) {
+            /* set masked-off elements to 1s */
+            for (uint32_t k = 0; k < nf; k++) {
                 vext_set_elems_1s(vd, vma, (i + k * max_elems) * esz,
                                   (i + k * max_elems + 1) * esz);
-                k++;
-                continue;
             }
-            abi_ptr addr = get_index_addr(base, i, vs2) + (k << log2_esz);
-            ldst_elem(env, adjust_addr(env, addr), i + k * max_elems, vd, ra);
-            k++;
+            continue;
         }
+        vext_ldst_segment(env, vd, get_index_addr(base, i, vs2), i, nf,
+                          max_elems, log2_esz, is_load, mmu_index, &page,
+                          ldst_tlb, ldst_host, ra);
     }
     env->vstart = 0;
 
     vext_set_tail_elems_1s(env->vl, vd, desc, nf, esz, max_elems);
 }
 
-#define GEN_VEXT_LD_INDEX(NAME, ETYPE, INDEX_FN, LOAD_FN)                  \
+#define GEN_VEXT_LD_INDEX(NAME, ETYPE, INDEX_FN, LOAD_FN_TLB, LOAD_FN_HOST) \
 void HELPER(NAME)(void *vd, void *v0, target_ulong base,                   \
                   void *vs2, CPURISCVState *env, uint32_t desc)            \
 {                                                                          \
     vext_ldst_index(vd, v0, base, vs2, env, desc, INDEX_FN,                \
-                    LOAD_FN, ctzl(sizeof(ETYPE)), GETPC());                \
-}
-
-GEN_VEXT_LD_INDEX(vlxei8_8_v,   int8_t,  idx_b, lde_b_tlb)
-GEN_VEXT_LD_INDEX(vlxei8_16_v,  int16_t, idx_b, lde_h_tlb)
-GEN_VEXT_LD_INDEX(vlxei8_32_v,  int32_t, idx_b, lde_w_tlb)
-GEN_VEXT_LD_INDEX(vlxei8_64_v,  int64_t, idx_b, lde_d_tlb)
-GEN_VEXT_LD_INDEX(vlxei16_8_v,  int8_t,  idx_h, lde_b_tlb)
-GEN_VEXT_LD_INDEX(vlxei16_16_v, int16_t, idx_h, lde_h_tlb)
-GEN_VEXT_LD_INDEX(vlxei16_32_v, int32_t, idx_h, lde_w_tlb)
-GEN_VEXT_LD_INDEX(vlxei16_64_v, int64_t, idx_h, lde_d_tlb)
-GEN_VEXT_LD_INDEX(vlxei32_8_v,  int8_t,  idx_w, lde_b_tlb)
-GEN_VEXT_LD_INDEX(vlxei32_16_v, int16_t, idx_w, lde_h_tlb)
-GEN_VEXT_LD_INDEX(vlxei32_32_v, int32_t, idx_w, lde_w_tlb)
-GEN_VEXT_LD_INDEX(vlxei32_64_v, int64_t, idx_w, lde_d_tlb)
-GEN_VEXT_LD_INDEX(vlxei64_8_v,  int8_t,  idx_d, lde_b_tlb)
-GEN_VEXT_LD_INDEX(vlxei64_16_v, int16_t, idx_d, lde_h_tlb)
-GEN_VEXT_LD_INDEX(vlxei64_32_v, int32_t, idx_d, lde_w_tlb)
-GEN_VEXT_LD_INDEX(vlxei64_64_v, int64_t, idx_d, lde_d_tlb)
-
-#define GEN_VEXT_ST_INDEX(NAME, ETYPE, INDEX_FN, STORE_FN)       \
-void HELPER(NAME)(void *vd, void *v0, target_ulong base,         \
-                  void *vs2, CPURISCVState *env, uint32_t desc)  \
-{                                                                \
-    vext_ldst_index(vd, v0, base, vs2, env, desc, INDEX_FN,      \
-                    STORE_FN, ctzl(sizeof(ETYPE)),               \
-                    GETPC());                                    \
-}
-
-GEN_VEXT_ST_INDEX(vsxei8_8_v,   int8_t,  idx_b, ste_b_tlb)
-GEN_VEXT_ST_INDEX(vsxei8_16_v,  int16_t, idx_b, ste_h_tlb)
-GEN_VEXT_ST_INDEX(vsxei8_32_v,  int32_t, idx_b, ste_w_tlb)
-GEN_VEXT_ST_INDEX(vsxei8_64_v,  int64_t, idx_b, ste_d_tlb)
-GEN_VEXT_ST_INDEX(vsxei16_8_v,  int8_t,  idx_h, ste_b_tlb)
-GEN_VEXT_ST_INDEX(vsxei16_16_v, int16_t, idx_h, ste_h_tlb)
-GEN_VEXT_ST_INDEX(vsxei16_32_v, int32_t, idx_h, ste_w_tlb)
-GEN_VEXT_ST_INDEX(vsxei16_64_v, int64_t, idx_h, ste_d_tlb)
-GEN_VEXT_ST_INDEX(vsxei32_8_v,  int8_t,  idx_w, ste_b_tlb)
-GEN_VEXT_ST_INDEX(vsxei32_16_v, int16_t, idx_w, ste_h_tlb)
-GEN_VEXT_ST_INDEX(vsxei32_32_v, int32_t, idx_w, ste_w_tlb)
-GEN_VEXT_ST_INDEX(vsxei32_64_v, int64_t, idx_w, ste_d_tlb)
-GEN_VEXT_ST_INDEX(vsxei64_8_v,  int8_t,  idx_d, ste_b_tlb)
-GEN_VEXT_ST_INDEX(vsxei64_16_v, int16_t, idx_d, ste_h_tlb)
-GEN_VEXT_ST_INDEX(vsxei64_32_v, int32_t, idx_d, ste_w_tlb)
-GEN_VEXT_ST_INDEX(vsxei64_64_v, int64_t, idx_d, ste_d_tlb)
+                    LOAD_FN_TLB, LOAD_FN_HOST, ctzl(sizeof(ETYPE)),        \
+                    GETPC(), true);                                        \
+}
+
+GEN_VEXT_LD_INDEX(vlxei8_8_v,   int8_t,  idx_b, lde_b_tlb, lde_b_host)
+GEN_VEXT_LD_INDEX(vlxei8_16_v,  int16_t, idx_b, lde_h_tlb, lde_h_host)
+GEN_VEXT_LD_INDEX(vlxei8_32_v,  int32_t, idx_b, lde_w_tlb, lde_w_host)
+GEN_VEXT_LD_INDEX(vlxei8_64_v,  int64_t, idx_b, lde_d_tlb, lde_d_host)
+GEN_VEXT_LD_INDEX(vlxei16_8_v,  int8_t,  idx_h, lde_b_tlb, lde_b_host)
+GEN_VEXT_LD_INDEX(vlxei16_16_v, int16_t, idx_h, lde_h_tlb, lde_h_host)
+GEN_VEXT_LD_INDEX(vlxei16_32_v, int32_t, idx_h, lde_w_tlb, lde_w_host)
+GEN_VEXT_LD_INDEX(vlxei16_64_v, int64_t, idx_h, lde_d_tlb, lde_d_host)
+GEN_VEXT_LD_INDEX(vlxei32_8_v,  int8_t,  idx_w, lde_b_tlb, lde_b_host)
+GEN_VEXT_LD_INDEX(vlxei32_16_v, int16_t, idx_w, lde_h_tlb, lde_h_host)
+GEN_VEXT_LD_INDEX(vlxei32_32_v, int32_t, idx_w, lde_w_tlb, lde_w_host)
+GEN_VEXT_LD_INDEX(vlxei32_64_v, int64_t, idx_w, lde_d_tlb, lde_d_host)
+GEN_VEXT_LD_INDEX(vlxei64_8_v,  int8_t,  idx_d, lde_b_tlb, lde_b_host)
+GEN_VEXT_LD_INDEX(vlxei64_16_v, int16_t, idx_d, lde_h_tlb, lde_h_host)
+GEN_VEXT_LD_INDEX(vlxei64_32_v, int32_t, idx_d, lde_w_tlb, lde_w_host)
+GEN_VEXT_LD_INDEX(vlxei64_64_v, int64_t, idx_d, lde_d_tlb, lde_d_host)
+
+#define GEN_VEXT_ST_INDEX(NAME, ETYPE, INDEX_FN, STORE_FN_TLB, STORE_FN_HOST) \
+void HELPER(NAME)(void *vd, void *v0, target_ulong base,                     \
+                  void *vs2, CPURISCVState *env, uint32_t desc)              \
+{                                                                            \
+    vext_ldst_index(vd, v0, base, vs2, env, desc, INDEX_FN,                  \
+                    STORE_FN_TLB, STORE_FN_HOST, ctzl(sizeof(ETYPE)),        \
+                    GETPC(), false);                                         \
+}
+
+GEN_VEXT_ST_INDEX(vsxei8_8_v,   int8_t,  idx_b, ste_b_tlb, ste_b_host)
+GEN_VEXT_ST_INDEX(vsxei8_16_v,  int16_t, idx_b, ste_h_tlb, ste_h_host)
+GEN_VEXT_ST_INDEX(vsxei8_32_v,  int32_t, idx_b, ste_w_tlb, ste_w_host)
+GEN_VEXT_ST_INDEX(vsxei8_64_v,  int64_t, idx_b, ste_d_tlb, ste_d_host)
+GEN_VEXT_ST_INDEX(vsxei16_8_v,  int8_t,  idx_h, ste_b_tlb, ste_b_host)
+GEN_VEXT_ST_INDEX(vsxei16_16_v, int16_t, idx_h, ste_h_tlb, ste_h_host)
+GEN_VEXT_ST_INDEX(vsxei16_32_v, int32_t, idx_h, ste_w_tlb, ste_w_host)
+GEN_VEXT_ST_INDEX(vsxei16_64_v, int64_t, idx_h, ste_d_tlb, ste_d_host)
+GEN_VEXT_ST_INDEX(vsxei32_8_v,  int8_t,  idx_w, ste_b_tlb, ste_b_host)
+GEN_VEXT_ST_INDEX(vsxei32_16_v, int16_t, idx_w, ste_h_tlb, ste_h_host)
+GEN_VEXT_ST_INDEX(vsxei32_32_v, int32_t, idx_w, ste_w_tlb, ste_w_host)
+GEN_VEXT_ST_INDEX(vsxei32_64_v, int64_t, idx_w, ste_d_tlb, ste_d_host)
+GEN_VEXT_ST_INDEX(vsxei64_8_v,  int8_t,  idx_d, ste_b_tlb, ste_b_host)
+GEN_VEXT_ST_INDEX(vsxei64_16_v, int16_t, idx_d, ste_h_tlb, ste_h_host)
+GEN_VEXT_ST_INDEX(vsxei64_32_v, int32_t, idx_d, ste_w_tlb, ste_w_host)
+GEN_VEXT_ST_INDEX(vsxei64_64_v, int64_t, idx_d, ste_d_tlb, ste_d_host)
 
 /*
  * unit-stride fault-only-fisrt load instructions
@@ -987,6 +1054,39 @@ void HELPER(vec_rsubs64)(void *d, void *a, uint64_t b, uint32_t desc)
     }
 }
 
+/*
+ * Expand the mask register into one element of all 0s or all 1s per
+ * mask bit, for the SEW in the desc data, so that masked instructions
+ * can be merged with GVEC bitwise operations.
+ */
+void HELPER(vmask_expand)(void *d, void *v0, uint32_t desc)
+{
+    uint32_t log2_esz = simd_data(desc);
+    uint32_t n = simd_oprsz(desc) >> log2_esz;
+    uint32_t i;
+
+    for (i = 0; i < n; i++) {
+        uint64_t m = -(uint64_t)vext_elem_mask(v0, i);
+
+        switch (log2_esz) {
+        case MO_8:
+            *((uint8_t *)d + H1(i)) = m;
+            break;
+        case MO_16:
+            *((uint16_t *)d + H2(i)) = m;
+            break;
+        case MO_32:
+            *((uint32_t *)d + H4(i)) = m;
+            break;
+        case MO_64:
+            *((uint64_t *)d + H8(i)) = m;
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+}
+
 /* Vector Widening Integer Add/Subtract */
 #define WOP_UUU_B uint16_t, uint8_t, uint8_t, uint16_t, uint16_t
 #define WOP_UUU_H uint32_t, uint16_t, uint16_t, uint32_t, uint32_t
@@ -3118,12 +3218,54 @@ void HELPER(NAME)(void *vd, void *v0, void *vs1,          \
                       total_elems * ESZ);                 \
 }
 
+/*
+ * Unmasked single-width ops hand the active elements to softfloat as one
+ * array, so that they go through hardfloat a group at a time. This needs
+ * the elements to be contiguous in host order, which for SEW=32 is only
+ * the case on little-endian hosts.
+ */
+#define GEN_VEXT_VV_ENV_N(NAME, ESZ, ETYPE, OP_N)         \
+void HELPER(NAME)(void *vd, void *v0, void *vs1,          \
+                  void *vs2, CPURISCVState *env,          \
+                  uint32_t desc)                          \
+{                                                         \
+    uint32_t vm = vext_vm(desc);                          \
+    uint32_t vl = env->vl;                                \
+    uint32_t total_elems =                                \
+        vext_get_total_elems(env, desc, ESZ);             \
+    uint32_t vta = vext_vta(desc);                        \
+    uint32_t vma = vext_vma(desc);                        \
+    uint32_t i;                                           \
+                                                          \
+    VSTART_CHECK_EARLY_EXIT(env, vl);                     \
+                                                          \
+    if (vm && (ESZ == 8 || !HOST_BIG_ENDIAN)) {           \
+        i = env->vstart;                                  \
+        OP_N((ETYPE *)vd + i, (ETYPE *)vs2 + i,           \
+             (ETYPE *)vs1 + i, vl - i, &env->fp_status);  \
+    } else {                                              \
+        for (i = env->vstart; i < vl; i++) {              \
+            if (!vm && !vext_elem_mask(v0, i)) {          \
+                /* set masked-off elements to 1s */       \
+                vext_set_elems_1s(vd, vma, i * ESZ,       \
+                                  (i + 1) * ESZ);         \
+                continue;                                 \
+            }                                             \
+            do_##NAME(vd, vs1, vs2, i, env);              \
+        }                                                 \
+    }                                                     \
+    env->vstart = 0;                                      \
+    /* set tail elements to 1s */                         \
+    vext_set_elems_1s(vd, vta, vl * ESZ,                  \
+                      total_elems * ESZ);                 \
+}
+
 RVVCALL(OPFVV2, vfadd_vv_h, OP_UUU_H, H2, H2, H2, float16_add)
 RVVCALL(OPFVV2, vfadd_vv_w, OP_UUU_W, H4, H4, H4, float32_add)
 RVVCALL(OPFVV2, vfadd_vv_d, OP_UUU_D, H8, H8, H8, float64_add)
 GEN_VEXT_VV_ENV(vfadd_vv_h, 2)
-GEN_VEXT_VV_ENV(vfadd_vv_w, 4)
-GEN_VEXT_VV_ENV(vfadd_vv_d, 8)
+GEN_VEXT_VV_ENV_N(vfadd_vv_w, 4, float32, float32_add_n)
+GEN_VEXT_VV_ENV_N(vfadd_vv_d, 8, float64, float64_add_n)
 
 #define OPFVF2(NAME, TD, T1, T2, TX1, TX2, HD, HS2, OP)        \
 static void do_##NAME(void *vd, uint64_t s1, void *vs2, int i, \
@@ -3174,8 +3316,8 @@ RVVCALL(OPFVV2, vfsub_vv_h, OP_UUU_H, H2, H2, H2, float16_sub)
 RVVCALL(OPFVV2, vfsub_vv_w, OP_UUU_W, H4, H4, H4, float32_sub)
 RVVCALL(OPFVV2, vfsub_vv_d, OP_UUU_D, H8, H8, H8, float64_sub)
 GEN_VEXT_VV_ENV(vfsub_vv_h, 2)
-GEN_VEXT_VV_ENV(vfsub_vv_w, 4)
-GEN_VEXT_VV_ENV(vfsub_vv_d, 8)
+GEN_VEXT_VV_ENV_N(vfsub_vv_w, 4, float32, float32_sub_n)
+GEN_VEXT_VV_ENV_N(vfsub_vv_d, 8, float64, float64_sub_n)
 RVVCALL(OPFVF2, vfsub_vf_h, OP_UUU_H, H2, H2, float16_sub)
 RVVCALL(OPFVF2, vfsub_vf_w, OP_UUU_W, H4, H4, float32_sub)
 RVVCALL(OPFVF2, vfsub_vf_d, OP_UUU_D, H8, H8, float64_sub)
@@ -3293,8 +3435,8 @@ RVVCALL(OPFVV2, vfmul_vv_h, OP_UUU_H, H2, H2, H2, float16_mul)
 RVVCALL(OPFVV2, vfmul_vv_w, OP_UUU_W, H4, H4, H4, float32_mul)
 RVVCALL(OPFVV2, vfmul_vv_d, OP_UUU_D, H8, H8, H8, float64_mul)
 GEN_VEXT_VV_ENV(vfmul_vv_h, 2)
-GEN_VEXT_VV_ENV(vfmul_vv_w, 4)
-GEN_VEXT_VV_ENV(vfmul_vv_d, 8)
+GEN_VEXT_VV_ENV_N(vfmul_vv_w, 4, float32, float32_mul_n)
+GEN_VEXT_VV_ENV_N(vfmul_vv_d, 8, float64, float64_mul_n)
 RVVCALL(OPFVF2, vfmul_vf_h, OP_UUU_H, H2, H2, float16_mul)
 RVVCALL(OPFVF2, vfmul_vf_w, OP_UUU_W, H4, H4, float32_mul)
 RVVCALL(OPFVF2, vfmul_vf_d, OP_UUU_D, H8, H8, float64_mul)
@@ -72,6 +72,8 @@ struct tcg_region_state {
     /* fields protected by the lock */
     size_t current; /* current region index */
     size_t agg_size_full; /* aggregate size of full regions */
+    uint64_t alloc_count; /* number of region allocations so far */
+    uint64_t *alloc_seq; /* alloc_count when a region was taken, 0 if free */
 };
 
 static struct tcg_region_state region;
@@ -191,10 +193,23 @@ static void tcg_region_trees_init(void)
     }
 }
 
-static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+/* Index of the region containing @p, which must be in code_gen_buffer */
+static size_t tcg_region_idx(const void *p)
 {
-    size_t region_idx;
+    ptrdiff_t offset;
+
+    if (p < region.start_aligned) {
+        return 0;
+    }
+    offset = p - region.start_aligned;
+    if (offset > region.stride * (region.n - 1)) {
+        return region.n - 1;
+    }
+    return offset / region.stride;
+}
 
+static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
+{
     /*
      * Like tcg_splitwx_to_rw, with no assert.  The pc may come from
      * a signal handler over which the caller has no control.
@@ -206,18 +221,7 @@ static struct tcg_region_tree *tc_ptr_to_region_tree(const void *p)
         }
     }
 
-    if (p < region.start_aligned) {
-        region_idx = 0;
-    } else {
-        ptrdiff_t offset = p - region.start_aligned;
-
-        if (offset > region.stride * (region.n - 1)) {
-            region_idx = region.n - 1;
-        } else {
-            region_idx = offset / region.stride;
-        }
-    }
-    return region_trees + region_idx * tree_size;
+    return region_trees + tcg_region_idx(p) * tree_size;
 }
 
 void tcg_tb_insert(TranslationBlock *tb)
@@ -359,11 +363,21 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
 
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
-    if (region.current == region.n) {
-        return true;
+    size_t i = region.current;
+
+    if (i == region.n) {
+        /* Every region has been handed out; reuse one freed by eviction. */
+        for (i = 0; i < region.n && region.alloc_seq[i]; i++) {
+            continue;
+        }
+        if (i == region.n) {
+            return true;
+        }
+    } else {
+        region.current++;
     }
-    tcg_region_assign(s, region.current);
-    region.current++;
+    tcg_region_assign(s, i);
+    region.alloc_seq[i] = ++region.alloc_count;
     return false;
 }
 
@@ -412,6 +426,7 @@ void tcg_region_reset_all(void)
     qemu_mutex_lock(&region.lock);
     region.current = 0;
     region.agg_size_full = 0;
+    memset(region.alloc_seq, 0, region.n * sizeof(*region.alloc_seq));
 
     for (i = 0; i < n_ctxs; i++) {
         TCGContext *s = qatomic_read(&tcg_ctxs[i]);
@@ -422,34 +437,99 @@ void tcg_region_reset_all(void)
     tcg_region_tree_reset_all();
 }
 
+/*
+ * Call from a safe-work context.  Find the full region that was taken
+ * longest ago and that no context is generating code into.  Returns
+ * false if there is none, i.e. every region in use belongs to a context.
+ */
+bool tcg_region_oldest_full(size_t *pidx)
+{
+    unsigned int n_ctxs = qatomic_read(&tcg_cur_ctxs);
+    g_autofree bool *busy = g_new0(bool, region.n);
+    uint64_t oldest = UINT64_MAX;
+    size_t i;
+
+    qemu_mutex_lock(&region.lock);
+    for (i = 0; i < n_ctxs; i++) {
+        const TCGContext *s = qatomic_read(&tcg_ctxs[i]);
+
+        busy[tcg_region_idx(s->code_gen_buffer)] = true;
+    }
+    for (i = 0; i < region.n; i++) {
+        if (!busy[i] && region.alloc_seq[i] &&
+            region.alloc_seq[i] < oldest) {
+            oldest = region.alloc_seq[i];
+            *pidx = i;
+        }
+    }
+    qemu_mutex_unlock(&region.lock);
+    return oldest != UINT64_MAX;
+}
+
+/* Call @func for each translation block in region @idx */
+void tcg_region_tb_foreach(size_t idx, GTraverseFunc func, gpointer user_data)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+
+    qemu_mutex_lock(&rt->lock);
+    q_tree_foreach(rt->tree, func, user_data);
+    qemu_mutex_unlock(&rt->lock);
+}
+
+/*
+ * Call from a safe-work context, once the translation blocks of the full
+ * region @idx can no longer be reached.  Drop them from the region tree
+ * and let the region be allocated again.
+ */
+void tcg_region_release(size_t idx)
+{
+    struct tcg_region_tree *rt = region_trees + idx * tree_size;
+    void *start, *end;
+
+    qemu_mutex_lock(&rt->lock);
+    /* Increment the refcount first so that destroy acts as a reset */
+    q_tree_ref(rt->tree);
+    q_tree_destroy(rt->tree);
+    qemu_mutex_unlock(&rt->lock);
+
+    tcg_region_bounds(idx, &start, &end);
+    qemu_mutex_lock(&region.lock);
+    g_assert(region.alloc_seq[idx]);
+    region.alloc_seq[idx] = 0;
+    region.agg_size_full -= end - start - TCG_HIGHWATER;
+    qemu_mutex_unlock(&region.lock);
+}
+
 static size_t tcg_n_regions(size_t tb_size, unsigned max_cpus)
 {
-#ifdef CONFIG_USER_ONLY
-    return 1;
-#else
-    size_t n_regions;
+    /* Regions should be >= 2 MB. */
+    size_t n_regions = tb_size / (2 * MiB);
 
+#ifndef CONFIG_USER_ONLY
     /*
      * It is likely that some vCPUs will translate more code than others,
      * so we first try to set more regions than max_cpus, with those regions
      * being of reasonable size. If that's not possible we make do by evenly
      * dividing the code_gen_buffer among the vCPUs.
      */
-    /* Use a single region if all we have is one vCPU thread */
-    if (max_cpus == 1 || !qemu_tcg_mttcg_enabled()) {
-        return 1;
+    if (max_cpus > 1 && qemu_tcg_mttcg_enabled()) {
+        /*
+         * Try to have more regions than max_cpus.
+         * If we can't, then just allocate one region per vCPU thread.
+         */
+        if (n_regions <= max_cpus) {
+            return max_cpus;
+        }
+        return MIN(n_regions, max_cpus * 8);
     }
+#endif
 
     /*
-     * Try to have more regions than max_cpus, with each region being >= 2 MB.
-     * If we can't, then just allocate one region per vCPU thread.
+     * A single vCPU thread fills the regions one after the other.  Split
+     * the buffer anyway, so that running out of space can evict the oldest
+     * region rather than flush everything.
      */
-    n_regions = tb_size / (2 * MiB);
-    if (n_regions <= max_cpus) {
-        return max_cpus;
-    }
-    return MIN(n_regions, max_cpus * 8);
-#endif
+    return MAX(1, MIN(n_regions, 8));
 }
 
 /*
@@ -851,6 +931,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
     }
 
     tcg_region_trees_init();
+    region.alloc_seq = g_new0(uint64_t, region.n);
 
     /*
      * Leave the initial context initialized to the first region.
@@ -0,0 +1,223 @@
+/*
+ * Check hfi_load/hfi_store against plain loads and stores of the same
+ * memory, and that they fault outside of the explicit data region.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define LARGE_ALIGN (64 * 1024)
+
+/* With the default of one data region, the first code region is #2. */
+#define DATA_REGION 0
+#define CODE_REGION 2
+#define R1_ENABLED (1 << 7)
+#define R1_READ (1 << 6)
+#define R1_WRITE (1 << 5)
+#define R1_IS_LARGE (1 << 4)
+#define R3_ENABLED (1 << 7)
+#define R3_EXEC (1 << 6)
+
+#define REGION_TYPE_EXPLICIT 1
+
+/* Encoded like the funct3 of loads and stores */
+#define MOP_B 0
+#define MOP_H 1
+#define MOP_W 2
+#define MOP_D 3
+#define MOP_BU 4
+#define MOP_HU 5
+#define MOP_WU 6
+
+#define SMALL_OFFSET 8
+#define SMALL_BOUND 100
+
+static uint8_t buf[2 * LARGE_ALIGN] __attribute__((aligned(LARGE_ALIGN)));
+
+static void hfi_set_region_size(uint64_t region, uint64_t base,
+                                uint64_t bound)
+{
+    asm volatile(".insn r 0x0b, 2, 0, %0, %1, %2"
+                 : : "r"(region), "r"(base), "r"(bound) : "memory");
+}
+
+static void hfi_set_region_permissions(uint64_t region, uint64_t perm)
+{
+    asm volatile(".insn r 0x0b, 3, 0, x0, %0, %1"
+                 : : "r"(region), "r"(perm) : "memory");
+}
+
+/*
+ * hfi_load/hfi_store are only valid inside a sandbox: wrap each of them
+ * in hfi_enter/hfi_exit.
+ */
+#define HFI_LOAD(mop, offset) ({                                    \
+    uint64_t val_;                                                  \
+    asm volatile(".insn r 0x0b, 0, 0, x0, %1, x0\n\t"               \
+                 ".insn i 0x0b, 4, %0, %2, %3\n\t"                  \
+                 ".insn r 0x0b, 1, 0, x0, x0, x0"                   \
+                 : "=&r"(val_)                                      \
+                 : "r"((uint64_t)REGION_TYPE_EXPLICIT),             \
+                   "r"((uint64_t)(offset)),                         \
+                   "i"((mop) << 5 | DATA_REGION)                    \
+                 : "memory");                                       \
+    val_;                                                           \
+})
+
+#define HFI_STORE(mop, offset, val)                                 \
+    asm volatile(".insn r 0x0b, 0, 0, x0, %0, x0\n\t"               \
+                 ".insn i 0x0b, 5, %1, %2, %3\n\t"                  \
+                 ".insn r 0x0b, 1, 0, x0, x0, x0"                   \
+                 : : "r"((uint64_t)REGION_TYPE_EXPLICIT),           \
+                   "r"((uint64_t)(val)), "r"((uint64_t)(offset)),   \
+                   "i"((mop) << 5 | DATA_REGION)                    \
+                 : "memory")
+
+/* Run fn in a child; return the signal that killed it, or 0. */
+static int run_in_child(void (*fn)(void))
+{
+    struct rlimit no_core = { 0, 0 };
+    int status;
+    pid_t pid = fork();
+
+    assert(pid >= 0);
+    if (pid == 0) {
+        setrlimit(RLIMIT_CORE, &no_core);
+        fn();
+        _exit(EXIT_SUCCESS);
+    }
+    assert(waitpid(pid, &status, 0) == pid);
+    if (WIFSIGNALED(status)) {
+        return WTERMSIG(status);
+    }
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    return 0;
+}
+
+static void set_region(uint64_t base, uint64_t bound, uint64_t perm)
+{
+    hfi_set_region_size(DATA_REGION, base, bound);
+    hfi_set_region_permissions(DATA_REGION, R1_ENABLED | perm);
+}
+
+/* Compare every load width and extension with a plain load. */
+static void check_loads(uint8_t *base, uint64_t offset)
+{
+    uint8_t *p = base + offset;
+
+    assert(HFI_LOAD(MOP_B, offset) == (uint64_t)*(int8_t *)p);
+    assert(HFI_LOAD(MOP_BU, offset) == *(uint8_t *)p);
+    if (offset % 2 == 0) {
+        assert(HFI_LOAD(MOP_H, offset) == (uint64_t)*(int16_t *)p);
+        assert(HFI_LOAD(MOP_HU, offset) == *(uint16_t *)p);
+    }
+    if (offset % 4 == 0) {
+        assert(HFI_LOAD(MOP_W, offset) == (uint64_t)*(int32_t *)p);
+        assert(HFI_LOAD(MOP_WU, offset) == *(uint32_t *)p);
+    }
+    if (offset % 8 == 0) {
+        assert(HFI_LOAD(MOP_D, offset) == *(uint64_t *)p);
+    }
+}
+
+/* Store through the region and read back with plain loads. */
+static void check_stores(uint8_t *base, uint64_t offset)
+{
+    uint64_t val = 0x8877665544332211ull ^ offset;
+    uint8_t *p = base + offset;
+
+    HFI_STORE(MOP_D, offset, val);
+    assert(*(uint64_t *)p == val);
+    HFI_STORE(MOP_W, offset, ~val);
+    assert(*(uint32_t *)p == (uint32_t)~val);
+    HFI_STORE(MOP_H, offset, val >> 8);
+    assert(*(uint16_t *)p == (uint16_t)(val >> 8));
+    HFI_STORE(MOP_B, offset, 0xa5);
+    assert(*p == 0xa5);
+}
+
+static void ld_past_small_bound(void)
+{
+    HFI_LOAD(MOP_D, SMALL_BOUND - 7);
+}
+
+static void lb_at_small_bound(void)
+{
+    HFI_LOAD(MOP_B, SMALL_BOUND);
+}
+
+static void ld_negative_offset(void)
+{
+    HFI_LOAD(MOP_D, -8);
+}
+
+static void sd_read_only(void)
+{
+    set_region((uintptr_t)buf, SMALL_BOUND, R1_READ);
+    HFI_STORE(MOP_D, 0, 0);
+}
+
+static void ld_write_only(void)
+{
+    set_region((uintptr_t)buf, SMALL_BOUND, R1_WRITE);
+    HFI_LOAD(MOP_D, 0);
+}
+
+static void ld_disabled(void)
+{
+    hfi_set_region_permissions(DATA_REGION, R1_READ | R1_WRITE);
+    HFI_LOAD(MOP_D, 0);
+}
+
+static void ld_past_large_bound(void)
+{
+    HFI_LOAD(MOP_D, LARGE_ALIGN);
+}
+
+int main(void)
+{
+    uint8_t *small = buf + SMALL_OFFSET;
+
+    for (size_t i = 0; i < sizeof(buf); i++) {
+        buf[i] = i * 0x9d + 0x80;
+    }
+
+    /* A single code region covering the whole address space. */
+    hfi_set_region_size(CODE_REGION, 0, 0);
+    hfi_set_region_permissions(CODE_REGION, R3_ENABLED | R3_EXEC);
+
+    /* Small regions: byte granular base and bound */
+    set_region((uintptr_t)small, SMALL_BOUND, R1_READ | R1_WRITE);
+    for (uint64_t offset = 0; offset < 16; offset++) {
+        check_loads(small, offset);
+    }
+    check_loads(small, SMALL_BOUND - 8);
+    check_loads(small, SMALL_BOUND - 1);
+    check_stores(small, 0);
+    check_stores(small, SMALL_BOUND - 8);
+
+    assert(run_in_child(ld_past_small_bound) == SIGSEGV);
+    assert(run_in_child(lb_at_small_bound) == SIGSEGV);
+    assert(run_in_child(ld_negative_offset) == SIGSEGV);
+    assert(run_in_child(sd_read_only) == SIGSEGV);
+    assert(run_in_child(ld_write_only) == SIGSEGV);
+    assert(run_in_child(ld_disabled) == SIGSEGV);
+
+    /* Large regions: base and bound are rounded down to 64KiB */
+    set_region((uintptr_t)buf + 0x123, LARGE_ALIGN + 0x456,
+               R1_READ | R1_WRITE | R1_IS_LARGE);
+    check_loads(buf, 0);
+    check_loads(buf, LARGE_ALIGN - 8);
+    check_stores(buf, LARGE_ALIGN - 8);
+    assert(run_in_child(ld_past_large_bound) == SIGSEGV);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+/*
+ * Check that hfi_enter/hfi_exit switch the region checks on and off, then
+ * ping-pong through them to measure the cost of an HFI sandbox transition.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ITERATIONS 1000000
+#define PAGE_SIZE 4096
+
+/*
+ * With the default of one data region, region #0 is the explicit data
+ * region, #1 the implicit data region and #2 the code region.
+ */
+#define EXPLICIT_REGION 0
+#define IMPLICIT_REGION 1
+#define CODE_REGION 2
+#define R1_ENABLED (1 << 7)
+#define R1_READ (1 << 6)
+#define R2_ENABLED (1 << 7)
+#define R2_READ (1 << 6)
+#define R3_ENABLED (1 << 7)
+#define R3_EXEC (1 << 6)
+
+#define REGION_TYPE_IMPLICIT 0
+#define REGION_TYPE_EXPLICIT 1
+/* hfi_enter takes the context index in bits [15:8] of rs1 */
+#define CONTEXT(n) ((n) << 8)
+
+static uint64_t inside[PAGE_SIZE / 8] __attribute__((aligned(PAGE_SIZE)));
+static uint64_t outside[PAGE_SIZE / 8] __attribute__((aligned(PAGE_SIZE)));
+
+static void hfi_set_region_size(uint64_t region, uint64_t base,
+                                uint64_t mask)
+{
+    asm volatile(".insn r 0x0b, 2, 0, %0, %1, %2"
+                 : : "r"(region), "r"(base), "r"(mask) : "memory");
+}
+
+static void hfi_set_region_permissions(uint64_t region, uint64_t perm)
+{
+    asm volatile(".insn r 0x0b, 3, 0, x0, %0, %1"
+                 : : "r"(region), "r"(perm) : "memory");
+}
+
+static void hfi_enter(uint64_t type, uint64_t handler)
+{
+    asm volatile(".insn r 0x0b, 0, 0, x0, %0, %1"
+                 : : "r"(type), "r"(handler) : "memory");
+}
+
+static void hfi_exit(void)
+{
+    asm volatile(".insn r 0x0b, 1, 0, x0, x0, x0" : : : "memory");
+}
+
+/*
+ * Load from p inside an implicit region sandbox.  Enter, load and exit
+ * are a single asm statement so that the compiler cannot put spills to
+ * the stack, which is outside of the data region, inside the sandbox.
+ */
+static uint64_t sandboxed_ld(const uint64_t *p)
+{
+    uint64_t val;
+
+    asm volatile(".insn r 0x0b, 0, 0, x0, %1, x0\n\t"
+                 "ld %0, 0(%2)\n\t"
+                 ".insn r 0x0b, 1, 0, x0, x0, x0"
+                 : "=&r"(val)
+                 : "r"((uint64_t)REGION_TYPE_IMPLICIT), "r"(p)
+                 : "memory");
+    return val;
+}
+
+/* hfi_load of a doubleword (mop 3) from the explicit data region */
+static uint64_t sandboxed_hfi_ld(uint64_t offset)
+{
+    uint64_t val;
+
+    asm volatile(".insn r 0x0b, 0, 0, x0, %1, x0\n\t"
+                 ".insn i 0x0b, 4, %0, %2, %3\n\t"
+                 ".insn r 0x0b, 1, 0, x0, x0, x0"
+                 : "=&r"(val)
+                 : "r"((uint64_t)REGION_TYPE_EXPLICIT), "r"(offset),
+                   "i"(3 << 5 | EXPLICIT_REGION)
+                 : "memory");
+    return val;
+}
+
+/* Run fn in a child; return the signal that killed it, or 0. */
+static int run_in_child(void (*fn)(void))
+{
+    struct rlimit no_core = { 0, 0 };
+    int status;
+    pid_t pid = fork();
+
+    assert(pid >= 0);
+    if (pid == 0) {
+        setrlimit(RLIMIT_CORE, &no_core);
+        fn();
+        _exit(EXIT_SUCCESS);
+    }
+    assert(waitpid(pid, &status, 0) == pid);
+    if (WIFSIGNALED(status)) {
+        return WTERMSIG(status);
+    }
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    return 0;
+}
+
+static void ld_inside(void)
+{
+    assert(sandboxed_ld(&inside[1]) == 1);
+}
+
+static void ld_outside(void)
+{
+    sandboxed_ld(&outside[1]);
+}
+
+static void hfi_ld_in_bound(void)
+{
+    assert(sandboxed_hfi_ld(sizeof(inside) - 8) == 2);
+}
+
+static void hfi_ld_past_bound(void)
+{
+    sandboxed_hfi_ld(sizeof(inside));
+}
+
+static void enter_bad_context(void)
+{
+    /* The default hfi-contexts is 1, so context #1 does not exist. */
+    hfi_enter(REGION_TYPE_EXPLICIT | CONTEXT(1), 0);
+    hfi_exit();
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int main(void)
+{
+    uint64_t start, elapsed;
+    volatile int count = 0;
+
+    inside[1] = 1;
+    inside[PAGE_SIZE / 8 - 1] = 2;
+    outside[1] = 4;
+
+    /* A single code region covering the whole address space. */
+    hfi_set_region_size(CODE_REGION, 0, 0);
+    hfi_set_region_permissions(CODE_REGION, R3_ENABLED | R3_EXEC);
+
+    /* Both data regions cover exactly the inside page, read-only. */
+    hfi_set_region_size(IMPLICIT_REGION, (uintptr_t)inside,
+                        ~(uint64_t)(PAGE_SIZE - 1));
+    hfi_set_region_permissions(IMPLICIT_REGION, R2_ENABLED | R2_READ);
+    hfi_set_region_size(EXPLICIT_REGION, (uintptr_t)inside, sizeof(inside));
+    hfi_set_region_permissions(EXPLICIT_REGION, R1_ENABLED | R1_READ);
+
+    assert(run_in_child(ld_inside) == 0);
+    assert(run_in_child(ld_outside) == SIGSEGV);
+    assert(run_in_child(hfi_ld_in_bound) == 0);
+    assert(run_in_child(hfi_ld_past_bound) == SIGSEGV);
+    assert(run_in_child(enter_bad_context) == SIGILL);
+
+    /* Once out of the sandbox, the same access is allowed again. */
+    assert(sandboxed_ld(&inside[1]) == 1);
+    assert(*(volatile uint64_t *)&outside[1] == 4);
+
+    start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        hfi_enter(REGION_TYPE_EXPLICIT, 0);
+        count++;
+        hfi_exit();
+    }
+    elapsed = now_ns() - start;
+
+    assert(count == ITERATIONS);
+    printf("%d hfi_enter/hfi_exit round trips: %" PRIu64 " ns each\n",
+           ITERATIONS, elapsed / ITERATIONS);
+    return EXIT_SUCCESS;
+}
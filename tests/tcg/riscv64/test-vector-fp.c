@@ -0,0 +1,221 @@
+/*
+ * Compare vfadd.vv, vfsub.vv and vfmul.vv with the scalar instructions,
+ * result and accrued flags, for special and random operands under
+ * several rounding modes.  Unmasked ops go through the batched hardfloat
+ * path, masked ones through the per-element loop: both must agree with
+ * the scalar ones.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Enough for LMUL=8 at VLEN=4096 and SEW=32 */
+#define N_MAX 1024
+#define BATCHES 32
+
+#define FFLAGS_NX 1
+
+#define VREGS "v0", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15", \
+              "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23",    \
+              "v24", "v25", "v26", "v27", "v28", "v29", "v30", "v31"
+
+typedef size_t VectorFn(void *d, const void *a, const void *b, size_t n,
+                        bool masked);
+typedef uint64_t ScalarFn(uint64_t a, uint64_t b);
+
+/* With masked, all elements are active but the op takes the mask. */
+#define DEF_VOP(op, W)                                                      \
+static size_t v##op##W(void *d, const void *a, const void *b, size_t n,    \
+                       bool masked)                                         \
+{                                                                           \
+    size_t vl;                                                              \
+    if (masked) {                                                           \
+        asm volatile("vsetvli %0, %1, e" #W ", m8, ta, ma\n\t"             \
+                     "vmset.m v0\n\t"                                       \
+                     "vle" #W ".v v16, (%3)\n\t"                            \
+                     "vle" #W ".v v24, (%4)\n\t"                            \
+                     "v" #op ".vv v8, v16, v24, v0.t\n\t"                   \
+                     "vse" #W ".v v8, (%2)"                                 \
+                     : "=&r"(vl) : "r"(n), "r"(d), "r"(a), "r"(b)           \
+                     : "memory", VREGS);                                    \
+    } else {                                                                \
+        asm volatile("vsetvli %0, %1, e" #W ", m8, ta, ma\n\t"             \
+                     "vle" #W ".v v16, (%3)\n\t"                            \
+                     "vle" #W ".v v24, (%4)\n\t"                            \
+                     "v" #op ".vv v8, v16, v24\n\t"                         \
+                     "vse" #W ".v v8, (%2)"                                 \
+                     : "=&r"(vl) : "r"(n), "r"(d), "r"(a), "r"(b)           \
+                     : "memory", VREGS);                                    \
+    }                                                                       \
+    return vl;                                                              \
+}
+
+#define DEF_SOP(op, W, T, S)                                                \
+static uint64_t s##op##W(uint64_t a, uint64_t b)                            \
+{                                                                           \
+    T fa, fb, fr;                                                           \
+    uint64_t r = 0;                                                         \
+    memcpy(&fa, &a, sizeof(T));                                             \
+    memcpy(&fb, &b, sizeof(T));                                             \
+    asm volatile(#op "." S " %0, %1, %2" : "=f"(fr) : "f"(fa), "f"(fb));   \
+    memcpy(&r, &fr, sizeof(T));                                             \
+    return r;                                                               \
+}
+
+#define DEF_OPS(op)                                                         \
+    DEF_VOP(f##op, 32)                                                      \
+    DEF_VOP(f##op, 64)                                                      \
+    DEF_SOP(f##op, 32, float, "s")                                          \
+    DEF_SOP(f##op, 64, double, "d")
+
+DEF_OPS(add)
+DEF_OPS(sub)
+DEF_OPS(mul)
+
+static const struct {
+    size_t esz;
+    VectorFn *vec;
+    ScalarFn *scalar;
+} ops[] = {
+    { 4, vfadd32, sfadd32 },
+    { 8, vfadd64, sfadd64 },
+    { 4, vfsub32, sfsub32 },
+    { 8, vfsub64, sfsub64 },
+    { 4, vfmul32, sfmul32 },
+    { 8, vfmul64, sfmul64 },
+};
+
+static const uint32_t specials32[] = {
+    0x00000000, 0x80000000,             /* +-0 */
+    0x3f800000, 0xbfc00000,             /* 1, -1.5 */
+    0x3f800001, 0x40400000,             /* 1 + ulp, 3 */
+    0x00800000, 0x80800001,             /* +-smallest normals */
+    0x00000001, 0x807fffff,             /* +-denormals */
+    0x7f7fffff, 0x03800000,             /* max, 2^-120 */
+    0x7f800000, 0xff800000,             /* +-inf */
+    0x7fc00000, 0x7f800001,             /* qNaN, sNaN */
+};
+
+static const uint64_t specials64[] = {
+    0x0000000000000000ull, 0x8000000000000000ull,
+    0x3ff0000000000000ull, 0xbff8000000000000ull,
+    0x3ff0000000000001ull, 0x4008000000000000ull,
+    0x0010000000000000ull, 0x8010000000000001ull,
+    0x0000000000000001ull, 0x800fffffffffffffull,
+    0x7fefffffffffffffull, 0x0370000000000000ull,
+    0x7ff0000000000000ull, 0xfff0000000000000ull,
+    0x7ff8000000000000ull, 0x7ff0000000000001ull,
+};
+
+#define NSPECIALS 16
+
+static uint32_t seed = 1;
+
+static uint64_t rand64(void)
+{
+    uint64_t r = 0;
+
+    for (int i = 0; i < 4; i++) {
+        seed = seed * 1103515245 + 12345;
+        r = r << 16 | seed >> 16;
+    }
+    return r;
+}
+
+static size_t vlmax(size_t esz)
+{
+    size_t vl;
+
+    if (esz == 4) {
+        asm volatile("vsetvli %0, zero, e32, m8, ta, ma" : "=r"(vl));
+    } else {
+        asm volatile("vsetvli %0, zero, e64, m8, ta, ma" : "=r"(vl));
+    }
+    return vl;
+}
+
+/*
+ * Element i of batch n gets the pair of specials numbered n * vl + i
+ * while there are any left, and random bits after that.
+ */
+static void fill(void *a, void *b, size_t esz, size_t vl, int batch)
+{
+    for (size_t i = 0; i < vl; i++) {
+        size_t p = batch * vl + i;
+        uint64_t x = rand64(), y = rand64();
+
+        if (p < NSPECIALS * NSPECIALS) {
+            x = esz == 4 ? specials32[p % NSPECIALS]
+                         : specials64[p % NSPECIALS];
+            y = esz == 4 ? specials32[p / NSPECIALS]
+                         : specials64[p / NSPECIALS];
+        }
+        memcpy((uint8_t *)a + i * esz, &x, esz);
+        memcpy((uint8_t *)b + i * esz, &y, esz);
+    }
+}
+
+static void set_fcsr(uint64_t frm, uint64_t fflags)
+{
+    asm volatile("fsrm %0\n\tfsflags %1" : : "r"(frm), "r"(fflags));
+}
+
+static uint64_t get_fflags(void)
+{
+    uint64_t fflags;
+
+    asm volatile("frflags %0" : "=r"(fflags));
+    return fflags;
+}
+
+int main(void)
+{
+    static uint64_t a[N_MAX], b[N_MAX], d[N_MAX], ref[N_MAX];
+    /* RNE, RTZ and RUP */
+    static const uint64_t frms[] = { 0, 1, 3 };
+
+    for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+        size_t esz = ops[o].esz;
+        size_t n = vlmax(esz);
+
+        assert(n <= N_MAX);
+        for (int batch = 0; batch < BATCHES; batch++) {
+            fill(a, b, esz, n, batch);
+            for (size_t r = 0; r < sizeof(frms) / sizeof(frms[0]); r++) {
+                /*
+                 * Hardfloat is only used once inexact is set: try with the
+                 * flags clear and with NX already accrued.
+                 */
+                for (uint64_t nx = 0; nx <= FFLAGS_NX; nx++) {
+                    uint64_t sflags, vflags;
+
+                    set_fcsr(frms[r], nx);
+                    for (size_t i = 0; i < n; i++) {
+                        uint64_t x = 0, y = 0;
+
+                        memcpy(&x, (uint8_t *)a + i * esz, esz);
+                        memcpy(&y, (uint8_t *)b + i * esz, esz);
+                        x = ops[o].scalar(x, y);
+                        memcpy((uint8_t *)ref + i * esz, &x, esz);
+                    }
+                    sflags = get_fflags();
+
+                    for (int masked = 0; masked < 2; masked++) {
+                        set_fcsr(frms[r], nx);
+                        assert(ops[o].vec(d, a, b, n, masked) == n);
+                        vflags = get_fflags();
+                        assert(memcmp(d, ref, n * esz) == 0);
+                        assert(vflags == sflags);
+                    }
+                }
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
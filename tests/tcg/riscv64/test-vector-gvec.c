@@ -0,0 +1,256 @@
+/*
+ * Compare integer vector instructions with a scalar model, for every
+ * SEW, a fractional and several integer LMULs, both tail and mask
+ * policies, and with and without a mask.  vl == VLMAX takes the GVEC
+ * expansion and vl < VLMAX the helpers; both must give the same result.
+ *
+ * Run with rvv_ta_all_1s and rvv_ma_all_1s, so that agnostic elements
+ * are deterministic.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Enough for 8 registers of up to VLEN=4096 */
+#define GROUP_MAX (8 * 512)
+
+#define VREGS "v0", "v1", "v2", "v3", "v4", "v5", "v6", "v7",            \
+              "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15",      \
+              "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23",    \
+              "v24", "v25", "v26", "v27", "v28", "v29", "v30", "v31"
+
+#define SCALAR 0x123456789abcdef1ull
+#define IMM -7
+
+static uint8_t v0_buf[GROUP_MAX / 8];
+static uint8_t vd_buf[GROUP_MAX], vs2_buf[GROUP_MAX], vs1_buf[GROUP_MAX];
+
+/*
+ * Load v0, the groups at v8 (vd), v16 (vs2) and v24 (vs1) whole, run insn
+ * with the given vtype and avl, and store the 8 registers at v8 back.
+ */
+#define DEF_OP(name, insn)                                                  \
+static void name(uint64_t vtype, uint64_t avl, bool masked)                 \
+{                                                                           \
+    if (masked) {                                                           \
+        asm volatile(LOAD_ALL insn ", v0.t\n\t" STORE_VD                    \
+                     : : OPERANDS : "t0", "memory", VREGS);                 \
+    } else {                                                                \
+        asm volatile(LOAD_ALL insn "\n\t" STORE_VD                          \
+                     : : OPERANDS : "t0", "memory", VREGS);                 \
+    }                                                                       \
+}
+
+#define LOAD_ALL                                                            \
+    "vsetvli t0, zero, e8, m1, ta, ma\n\t"                                  \
+    "vl1re8.v v0, (%[v0])\n\t"                                              \
+    "vl8re8.v v8, (%[vd])\n\t"                                              \
+    "vl8re8.v v16, (%[vs2])\n\t"                                            \
+    "vl8re8.v v24, (%[vs1])\n\t"                                            \
+    "vsetvl t0, %[avl], %[vtype]\n\t"
+#define STORE_VD "vs8r.v v8, (%[vd])"
+#define OPERANDS                                                            \
+    [v0] "r"(v0_buf), [vd] "r"(vd_buf), [vs2] "r"(vs2_buf),                 \
+    [vs1] "r"(vs1_buf), [avl] "r"(avl), [vtype] "r"(vtype),                 \
+    [x] "r"(SCALAR)
+
+DEF_OP(vadd_vv, "vadd.vv v8, v16, v24")
+DEF_OP(vsub_vx, "vsub.vx v8, v16, %[x]")
+DEF_OP(vrsub_vi, "vrsub.vi v8, v16, -7")
+DEF_OP(vand_vv, "vand.vv v8, v16, v24")
+DEF_OP(vsll_vi, "vsll.vi v8, v16, 3")
+DEF_OP(vmax_vv, "vmax.vv v8, v16, v24")
+DEF_OP(vmul_vv, "vmul.vv v8, v16, v24")
+DEF_OP(vmerge_vvm, "vmerge.vvm v8, v16, v24, v0")
+DEF_OP(vmerge_vxm, "vmerge.vxm v8, v16, %[x], v0")
+
+static int64_t sext(uint64_t v, int sew)
+{
+    return (int64_t)(v << (64 - sew)) >> (64 - sew);
+}
+
+static uint64_t ref_add(uint64_t a, uint64_t b, int sew)
+{
+    return a + b;
+}
+
+static uint64_t ref_sub_x(uint64_t a, uint64_t b, int sew)
+{
+    return a - SCALAR;
+}
+
+static uint64_t ref_rsub_i(uint64_t a, uint64_t b, int sew)
+{
+    return IMM - a;
+}
+
+static uint64_t ref_and(uint64_t a, uint64_t b, int sew)
+{
+    return a & b;
+}
+
+static uint64_t ref_sll_i(uint64_t a, uint64_t b, int sew)
+{
+    return a << 3;
+}
+
+static uint64_t ref_mul(uint64_t a, uint64_t b, int sew)
+{
+    return a * b;
+}
+
+static uint64_t ref_max(uint64_t a, uint64_t b, int sew)
+{
+    return sext(a, sew) > sext(b, sew) ? a : b;
+}
+
+/* vmerge has no inactive elements: the mask picks vs1 (or x) over vs2. */
+static uint64_t ref_merge(uint64_t a, uint64_t b, int sew)
+{
+    return b;
+}
+
+static uint64_t ref_merge_x(uint64_t a, uint64_t b, int sew)
+{
+    return SCALAR;
+}
+
+static const struct {
+    void (*run)(uint64_t vtype, uint64_t avl, bool masked);
+    uint64_t (*ref)(uint64_t vs2, uint64_t vs1, int sew);
+    bool merge;
+} ops[] = {
+    { vadd_vv, ref_add },
+    { vsub_vx, ref_sub_x },
+    { vrsub_vi, ref_rsub_i },
+    { vand_vv, ref_and },
+    { vsll_vi, ref_sll_i },
+    { vmax_vv, ref_max },
+    { vmul_vv, ref_mul },
+    { vmerge_vvm, ref_merge, true },
+    { vmerge_vxm, ref_merge_x, true },
+};
+
+/* vlmul encodings and LMUL in eighths */
+static const struct {
+    uint64_t vlmul;
+    int eighths;
+} lmuls[] = {
+    { 7, 4 },   /* mf2 */
+    { 0, 8 },   /* m1 */
+    { 1, 16 },  /* m2 */
+    { 3, 64 },  /* m8 */
+};
+
+static uint64_t get_elem(const uint8_t *p, size_t i, size_t esz)
+{
+    uint64_t v = 0;
+
+    memcpy(&v, p + i * esz, esz);
+    return v;
+}
+
+static void set_elem(uint8_t *p, size_t i, size_t esz, uint64_t v)
+{
+    memcpy(p + i * esz, &v, esz);
+}
+
+static bool mask_bit(size_t i)
+{
+    return v0_buf[i / 8] & (1 << (i % 8));
+}
+
+static void fill(void *p, size_t len, uint32_t seed)
+{
+    uint8_t *b = p;
+
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        b[i] = seed >> 16;
+    }
+}
+
+/*
+ * Run op o with vl == VLMAX (GVEC) or vl == VLMAX - 1 (helper), from
+ * random inputs, and compare the whole vd register group with the model.
+ */
+static void check_op(size_t o, int sew, size_t l, bool ta, bool ma,
+                     bool masked, bool helper, size_t vlenb, uint32_t seed)
+{
+    static uint8_t expect[GROUP_MAX];
+    size_t esz = sew / 8;
+    int eighths = lmuls[l].eighths;
+    size_t vlmax = vlenb * eighths / esz / 8;
+    /* A fractional LMUL leaves the rest of the register as tail */
+    size_t total = vlenb * (eighths < 8 ? 8 : eighths) / esz / 8;
+    uint64_t vtype = lmuls[l].vlmul | __builtin_ctz(esz) << 3 |
+                     (uint64_t)ta << 6 | (uint64_t)ma << 7;
+    size_t vl = vlmax - helper;
+
+    fill(v0_buf, sizeof(v0_buf), seed);
+    fill(vd_buf, sizeof(vd_buf), seed + 1);
+    fill(vs2_buf, sizeof(vs2_buf), seed + 2);
+    fill(vs1_buf, sizeof(vs1_buf), seed + 3);
+
+    memcpy(expect, vd_buf, sizeof(expect));
+    for (size_t i = 0; i < total; i++) {
+        uint64_t a = get_elem(vs2_buf, i, esz);
+        uint64_t b = get_elem(vs1_buf, i, esz);
+
+        if (i >= vl) {
+            if (ta) {
+                set_elem(expect, i, esz, -1);
+            }
+        } else if (ops[o].merge && !mask_bit(i)) {
+            set_elem(expect, i, esz, a);
+        } else if (masked && !ops[o].merge && !mask_bit(i)) {
+            if (ma) {
+                set_elem(expect, i, esz, -1);
+            }
+        } else {
+            set_elem(expect, i, esz, ops[o].ref(a, b, sew));
+        }
+    }
+
+    ops[o].run(vtype, vl, masked);
+    assert(memcmp(vd_buf, expect, 8 * vlenb) == 0);
+}
+
+int main(void)
+{
+    uint32_t seed = 1;
+    size_t vlenb;
+
+    asm("csrr %0, vlenb" : "=r"(vlenb));
+    assert(8 * vlenb <= GROUP_MAX);
+
+    for (size_t o = 0; o < sizeof(ops) / sizeof(ops[0]); o++) {
+        for (int sew = 8; sew <= 64; sew *= 2) {
+            for (size_t l = 0; l < sizeof(lmuls) / sizeof(lmuls[0]); l++) {
+                /* ELEN is 64: SEW must not exceed LMUL * 64 */
+                if (sew * 8 > 64 * lmuls[l].eighths) {
+                    continue;
+                }
+                /* ta, ma, masked and helper, one bit each */
+                for (int flags = 0; flags < 16; flags++) {
+                    bool masked = flags & 4;
+
+                    /* vmerge only exists in the masked form */
+                    if (ops[o].merge && !masked) {
+                        continue;
+                    }
+                    check_op(o, sew, l, flags & 1, flags & 2, masked, flags & 8,
+                             vlenb, seed);
+                    seed += 4;
+                }
+            }
+        }
+    }
+
+    return EXIT_SUCCESS;
+}
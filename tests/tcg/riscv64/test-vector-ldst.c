@@ -0,0 +1,321 @@
+/*
+ * Compare strided, indexed and segment vector loads and stores with the
+ * same accesses done one element at a time.  The accesses run across
+ * page boundaries, with and without masks, and into an unmapped page.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <assert.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PAGE_SIZE 4096
+#define BUF_PAGES 64
+#define BUF_SIZE (BUF_PAGES * PAGE_SIZE)
+/* Requested number of elements; vl may be smaller for wide elements */
+#define N 40
+
+#define VREGS "v0", "v8", "v9", "v10", "v11", "v12", "v13", "v14", "v15", \
+              "v16", "v17", "v18", "v19", "v20", "v21", "v22", "v23"
+
+typedef size_t StridedFn(void *vec, uint8_t *base, long stride, size_t n,
+                         const uint8_t *mask);
+typedef size_t IndexedFn(void *vec, uint8_t *base, const void *index,
+                         size_t n, const uint8_t *mask);
+
+/*
+ * For loads, vec is loaded into the destination first, so that masked
+ * off elements keep their value (mask undisturbed), and the result is
+ * stored back to it.  For stores, vec is the data.  Segment loads put
+ * the second field N elements after the first one.
+ */
+#define DEF_VEXT(W)                                                         \
+static size_t vlse##W(void *vec, uint8_t *base, long stride, size_t n,     \
+                      const uint8_t *mask)                                  \
+{                                                                           \
+    size_t vl;                                                              \
+    asm volatile("vsetvli %0, %1, e" #W ", m8, ta, mu\n\t"                 \
+                 "vlm.v v0, (%3)\n\t"                                       \
+                 "vle" #W ".v v8, (%2)\n\t"                                 \
+                 "vlse" #W ".v v8, (%4), %5, v0.t\n\t"                      \
+                 "vse" #W ".v v8, (%2)"                                     \
+                 : "=&r"(vl)                                                \
+                 : "r"(n), "r"(vec), "r"(mask), "r"(base), "r"(stride)      \
+                 : "memory", VREGS);                                        \
+    return vl;                                                              \
+}                                                                           \
+                                                                            \
+static size_t vsse##W(void *vec, uint8_t *base, long stride, size_t n,     \
+                      const uint8_t *mask)                                  \
+{                                                                           \
+    size_t vl;                                                              \
+    asm volatile("vsetvli %0, %1, e" #W ", m8, ta, mu\n\t"                 \
+                 "vlm.v v0, (%3)\n\t"                                       \
+                 "vle" #W ".v v8, (%2)\n\t"                                 \
+                 "vsse" #W ".v v8, (%4), %5, v0.t"                          \
+                 : "=&r"(vl)                                                \
+                 : "r"(n), "r"(vec), "r"(mask), "r"(base), "r"(stride)      \
+                 : "memory", VREGS);                                        \
+    return vl;                                                              \
+}                                                                           \
+                                                                            \
+static size_t vlsseg2e##W(void *vec, uint8_t *base, long stride, size_t n, \
+                          const uint8_t *mask)                              \
+{                                                                           \
+    size_t vl;                                                              \
+    asm volatile("vsetvli %0, %1, e" #W ", m4, ta, mu\n\t"                 \
+                 "vlm.v v0, (%3)\n\t"                                       \
+                 "vle" #W ".v v8, (%2)\n\t"                                 \
+                 "vle" #W ".v v12, (%6)\n\t"                                \
+                 "vlsseg2e" #W ".v v8, (%4), %5, v0.t\n\t"                  \
+                 "vse" #W ".v v8, (%2)\n\t"                                 \
+                 "vse" #W ".v v12, (%6)"                                    \
+                 : "=&r"(vl)                                                \
+                 : "r"(n), "r"(vec), "r"(mask), "r"(base), "r"(stride),     \
+                   "r"((uint8_t *)vec + N * W / 8)                          \
+                 : "memory", VREGS);                                        \
+    return vl;                                                              \
+}                                                                           \
+                                                                            \
+static size_t vluxei##W(void *vec, uint8_t *base, const void *index,       \
+                        size_t n, const uint8_t *mask)                      \
+{                                                                           \
+    size_t vl;                                                              \
+    asm volatile("vsetvli %0, %1, e" #W ", m8, ta, mu\n\t"                 \
+                 "vlm.v v0, (%3)\n\t"                                       \
+                 "vle" #W ".v v8, (%2)\n\t"                                 \
+                 "vle" #W ".v v16, (%5)\n\t"                                \
+                 "vluxei" #W ".v v8, (%4), v16, v0.t\n\t"                   \
+                 "vse" #W ".v v8, (%2)"                                     \
+                 : "=&r"(vl)                                                \
+                 : "r"(n), "r"(vec), "r"(mask), "r"(base), "r"(index)       \
+                 : "memory", VREGS);                                        \
+    return vl;                                                              \
+}                                                                           \
+                                                                            \
+static size_t vsuxei##W(void *vec, uint8_t *base, const void *index,       \
+                        size_t n, const uint8_t *mask)                      \
+{                                                                           \
+    size_t vl;                                                              \
+    asm volatile("vsetvli %0, %1, e" #W ", m8, ta, mu\n\t"                 \
+                 "vlm.v v0, (%3)\n\t"                                       \
+                 "vle" #W ".v v8, (%2)\n\t"                                 \
+                 "vle" #W ".v v16, (%5)\n\t"                                \
+                 "vsuxei" #W ".v v8, (%4), v16, v0.t"                       \
+                 : "=&r"(vl)                                                \
+                 : "r"(n), "r"(vec), "r"(mask), "r"(base), "r"(index)       \
+                 : "memory", VREGS);                                        \
+    return vl;                                                              \
+}
+
+DEF_VEXT(8)
+DEF_VEXT(16)
+DEF_VEXT(32)
+DEF_VEXT(64)
+
+static const struct {
+    size_t esz;
+    StridedFn *vlse, *vsse, *vlsseg2;
+    IndexedFn *vluxei, *vsuxei;
+} widths[] = {
+    { 1, vlse8, vsse8, vlsseg2e8, vluxei8, vsuxei8 },
+    { 2, vlse16, vsse16, vlsseg2e16, vluxei16, vsuxei16 },
+    { 4, vlse32, vsse32, vlsseg2e32, vluxei32, vsuxei32 },
+    { 8, vlse64, vsse64, vlsseg2e64, vluxei64, vsuxei64 },
+};
+
+static const uint8_t masks[][(N + 7) / 8] = {
+    { 0xff, 0xff, 0xff, 0xff, 0xff },
+    { 0xb2, 0x5d, 0x0f, 0xe1, 0x96 },
+};
+
+static uint8_t *buf;
+static uint8_t ref[BUF_SIZE];
+
+static bool mask_bit(const uint8_t *mask, size_t i)
+{
+    return mask[i / 8] & (1 << (i % 8));
+}
+
+static void fill(void *p, size_t len, uint32_t seed)
+{
+    uint8_t *b = p;
+
+    for (size_t i = 0; i < len; i++) {
+        seed = seed * 1103515245 + 12345;
+        b[i] = seed >> 16;
+    }
+}
+
+/* Element i is at base + offsets[i] */
+static void check_load(size_t esz, size_t nf, const long *offsets,
+                       size_t vl, const uint8_t *mask, const void *vec,
+                       const void *before, uint8_t *base)
+{
+    for (size_t f = 0; f < nf; f++) {
+        for (size_t i = 0; i < N; i++) {
+            const uint8_t *got = (const uint8_t *)vec + (f * N + i) * esz;
+            const uint8_t *want =
+                (const uint8_t *)before + (f * N + i) * esz;
+
+            if (i < vl && mask_bit(mask, i)) {
+                want = base + offsets[i] + f * esz;
+            }
+            assert(memcmp(got, want, esz) == 0);
+        }
+    }
+}
+
+static void check_store(size_t esz, const long *offsets, size_t vl,
+                        const uint8_t *mask, const void *vec,
+                        uint8_t *base)
+{
+    for (size_t i = 0; i < vl; i++) {
+        if (mask_bit(mask, i)) {
+            memcpy(ref + (base - buf) + offsets[i],
+                   (const uint8_t *)vec + i * esz, esz);
+        }
+    }
+    assert(memcmp(buf, ref, BUF_SIZE) == 0);
+}
+
+static void test_width(size_t w, const uint8_t *mask)
+{
+    size_t esz = widths[w].esz;
+    long strides[] = {
+        esz, 3 * esz, -2 * (long)esz, PAGE_SIZE / 3, PAGE_SIZE + 1, 0,
+    };
+    /* Misaligned for wide elements, so that some of them cross pages */
+    uint8_t *base = buf + 16 * PAGE_SIZE - esz / 2;
+    uint64_t vec[2 * N], before[2 * N], index[N];
+    long offsets[N];
+    size_t vl;
+
+    for (size_t s = 0; s < sizeof(strides) / sizeof(strides[0]); s++) {
+        long stride = strides[s];
+
+        for (size_t i = 0; i < N; i++) {
+            offsets[i] = (long)i * stride;
+        }
+
+        fill(vec, sizeof(vec), s);
+        memcpy(before, vec, sizeof(vec));
+        vl = widths[w].vlse(vec, base, stride, N, mask);
+        check_load(esz, 1, offsets, vl, mask, vec, before, base);
+
+        if (stride < 0 || stride >= 2 * (long)esz) {
+            fill(vec, sizeof(vec), s + 100);
+            memcpy(before, vec, sizeof(vec));
+            vl = widths[w].vlsseg2(vec, base, stride, N, mask);
+            check_load(esz, 2, offsets, vl, mask, vec, before, base);
+        }
+
+        /* Strided stores to overlapping elements are not ordered */
+        if (stride != 0) {
+            fill(vec, sizeof(vec), s + 200);
+            memcpy(ref, buf, BUF_SIZE);
+            vl = widths[w].vsse(vec, base, stride, N, mask);
+            check_store(esz, offsets, vl, mask, vec, base);
+        }
+    }
+
+    /*
+     * Distinct, non-overlapping elements in a shuffled order; the offsets
+     * must fit in the index width.
+     */
+    for (size_t i = 0; i < N; i++) {
+        uint64_t off = (i * 17 % N) * (esz == 1 ? 5 : 1031);
+
+        offsets[i] = off;
+        memcpy((uint8_t *)index + i * esz, &off, esz);
+    }
+
+    fill(vec, sizeof(vec), 300);
+    memcpy(before, vec, sizeof(vec));
+    vl = widths[w].vluxei(vec, base, index, N, mask);
+    check_load(esz, 1, offsets, vl, mask, vec, before, base);
+
+    fill(vec, sizeof(vec), 400);
+    memcpy(ref, buf, BUF_SIZE);
+    vl = widths[w].vsuxei(vec, base, index, N, mask);
+    check_store(esz, offsets, vl, mask, vec, base);
+}
+
+/* Run fn in a child; return the signal that killed it, or 0. */
+static int run_in_child(void (*fn)(void))
+{
+    struct rlimit no_core = { 0, 0 };
+    int status;
+    pid_t pid = fork();
+
+    assert(pid >= 0);
+    if (pid == 0) {
+        setrlimit(RLIMIT_CORE, &no_core);
+        fn();
+        _exit(EXIT_SUCCESS);
+    }
+    assert(waitpid(pid, &status, 0) == pid);
+    if (WIFSIGNALED(status)) {
+        return WTERMSIG(status);
+    }
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+    return 0;
+}
+
+/* Element 3 of these is in the unmapped page that follows buf. */
+static uint8_t *fault_base(void)
+{
+    return buf + BUF_SIZE - 3 * PAGE_SIZE + 8;
+}
+
+static uint64_t fault_data[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+static void vlse64_fault(void)
+{
+    uint64_t vec[N];
+
+    vlse64(vec, fault_base(), PAGE_SIZE, 8, masks[0]);
+}
+
+static void vsse64_fault(void)
+{
+    vsse64(fault_data, fault_base(), PAGE_SIZE, 8, masks[0]);
+}
+
+int main(void)
+{
+    uint64_t val;
+
+    /* Shared, so that the parent sees the stores of a faulting child */
+    buf = mmap(NULL, BUF_SIZE + PAGE_SIZE, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    assert(buf != MAP_FAILED);
+    assert(munmap(buf + BUF_SIZE, PAGE_SIZE) == 0);
+    fill(buf, BUF_SIZE, 42);
+
+    for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); w++) {
+        for (size_t m = 0; m < sizeof(masks) / sizeof(masks[0]); m++) {
+            test_width(w, masks[m]);
+        }
+    }
+
+    assert(run_in_child(vlse64_fault) == SIGSEGV);
+
+    /* The elements before the faulting one are stored */
+    memset(buf + BUF_SIZE - 4 * PAGE_SIZE, 0, 4 * PAGE_SIZE);
+    assert(run_in_child(vsse64_fault) == SIGSEGV);
+    for (int i = 0; i < 3; i++) {
+        memcpy(&val, fault_base() + i * PAGE_SIZE, sizeof(val));
+        assert(val == fault_data[i]);
+    }
+
+    return EXIT_SUCCESS;
+}
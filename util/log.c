@@ -505,6 +505,9 @@ const QEMULogItem qemu_log_items[] = {
       "include VPU registers in the 'cpu' logging" },
     { LOG_INVALID_MEM, "invalid_mem",
       "log invalid memory accesses" },
+    { CPU_LOG_HFI, "hfi",
+      "RISC-V only: log HFI sandbox transitions, region checks and faults\n"
+      "(region checks only in TBs translated while it is enabled)" },
     { 0, NULL, NULL },
 };
 